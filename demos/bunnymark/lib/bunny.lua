@@ -46,13 +46,16 @@ function Bunny:update(delta_time)
   end
 end
 
-function Bunny:render()
+function Bunny:render(batch, index)
   --var angle = (((_vx.abs > MAX_SPEED) ? MAX_SPEED : _vx.abs) / MAX_SPEED) * 60.0
   --var rotation = _vx.sign * angle
   --_bank.blit(0, _x, _y, rotation)
   --_bank.blit(0, _x, _y, -1.0, -1.0)
   --_bank.blit(0, _x, _y, _vx.sign, _vy.sign)
-  self.bank:blit(0, self.x, self.y)
+  batch[index + 1] = 0
+  batch[index + 2] = self.x
+  batch[index + 3] = self.y
+  return index + 3
 end
 
 return Bunny
\ No newline at end of file
@@ -29,6 +29,7 @@ dump(Canvas)
   Canvas.background(0)
 
   self.bunnies = {}
+  self.batch = {}
   self.bank = Bank.new("assets/sheet.png", 26, 37)
   self.font = Font.default(15, 3)
   self.speed = 1.0
@@ -69,9 +70,15 @@ end
 function Main:render(_)
   Canvas.clear()
 
+  local batch = self.batch
+  local count = 0
   for _, bunny in pairs(self.bunnies) do
-    bunny:render()
+    count = bunny:render(batch, count)
   end
+  for i = #batch, count + 1, -1 do -- Trim the leftovers from previous (larger) batches.
+    batch[i] = nil
+  end
+  self.bank:blit_batch(batch)
 
   self.font:write(string.format("FPS: %d", System.fps()), 0, 0, "left")
   self.font:write(string.format("#%d bunnies", #self.bunnies), Canvas.width(), 0, "right")
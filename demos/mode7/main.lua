@@ -23,27 +23,6 @@ local function build_table(factor) -- 0.4
 end
 ]]--
 
-local function build_table(angle, elevation)
-  local cos, sin = math.cos(angle), math.sin(angle)
-  local a, b = cos, sin
-  local c, d = -sin, cos
-
-  local entries = {}
-
-  for scan_line = 1, Canvas.height() do
-    local yc = scan_line
-    local p = elevation / yc
-    entries[scan_line] = {
-        a = a * p,
-        b = b * p,
-        c = c * p,
-        d = d * p,
-      }
-  end
-
-  return entries
-end
-
 function Main:__ctor()
   Canvas.palette("6-bit-rgb")
   Canvas.background(0)
@@ -60,7 +39,7 @@ function Main:__ctor()
   self.elevation = 48
 
   self.surface:matrix(1, 0, 0, 1, Canvas.width() * 0.5, Canvas.height() * 0.5)
-  self.surface:table(build_table(math.pi * 0.5 - self.angle, self.elevation))
+  self.surface:table(math.pi * 0.5 - self.angle, self.elevation)
 end
 
 function Main:input()
@@ -97,7 +76,7 @@ function Main:input()
   end
 
   if recompute then
-    self.surface:table(build_table(math.pi * 0.5 - self.angle, self.elevation))
+    self.surface:table(math.pi * 0.5 - self.angle, self.elevation)
 end
 end
 
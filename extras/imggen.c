@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+// Converts a PNG image (with up to 256 distinct colors) to the engine pre-indexed format, which is loaded with no
+// decoding at all. The output file can retain the original name, as the engine detects the format by signature.
+//
+// Build with `cc -O2 -I../external/stb -o imggen imggen.c -lm`.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include <stb_image.h>
+
+// Keep in sync with `src/libs/fs/fs.c`.
+#define IMAGE_SIGNATURE         "TOFUIMG!"
+#define IMAGE_SIGNATURE_LENGTH  8
+
+#define IMAGE_VERSION           0
+
+#define MAX_COLORS              256
+
+#pragma pack(push, 1)
+typedef struct _Image_Header_t {
+    char signature[IMAGE_SIGNATURE_LENGTH];
+    uint8_t version;
+    uint8_t __reserved;
+    uint16_t colors;
+    uint32_t width;
+    uint32_t height;
+} Image_Header_t;
+#pragma pack(pop)
+
+static int find_color(const uint32_t palette[], size_t colors, uint32_t rgba)
+{
+    for (size_t i = 0; i < colors; ++i) {
+        if (palette[i] == rgba) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool convert(const char *input, const char *output)
+{
+    int width, height, components;
+    uint32_t *pixels = (uint32_t *)stbi_load(input, &width, &height, &components, STBI_rgb_alpha);
+    if (!pixels) {
+        fprintf(stderr, "can't decode file `%s` (%s)\n", input, stbi_failure_reason());
+        return false;
+    }
+
+    size_t count = (size_t)width * (size_t)height;
+    uint8_t *indexes = malloc(count);
+    if (!indexes) {
+        fprintf(stderr, "can't allocate %lu indexes\n", (unsigned long)count);
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    uint32_t palette[MAX_COLORS];
+    size_t colors = 0;
+    int last = -1;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t rgba = pixels[i]; // Stored as the in-memory byte-sequence, R first.
+        int index = (last >= 0 && palette[last] == rgba) ? last : find_color(palette, colors, rgba);
+        if (index == -1) {
+            if (colors == MAX_COLORS) {
+                fprintf(stderr, "file `%s` has more than %d colors\n", input, MAX_COLORS);
+                free(indexes);
+                stbi_image_free(pixels);
+                return false;
+            }
+            palette[colors] = rgba;
+            index = (int)colors++;
+        }
+        indexes[i] = (uint8_t)index;
+        last = index;
+    }
+    stbi_image_free(pixels);
+
+    FILE *stream = fopen(output, "wb");
+    if (!stream) {
+        fprintf(stderr, "can't create file `%s`\n", output);
+        free(indexes);
+        return false;
+    }
+
+    Image_Header_t header = { .version = IMAGE_VERSION, .colors = (uint16_t)colors, .width = (uint32_t)width, .height = (uint32_t)height };
+    memcpy(header.signature, IMAGE_SIGNATURE, IMAGE_SIGNATURE_LENGTH);
+
+    bool result = fwrite(&header, sizeof(Image_Header_t), 1, stream) == 1
+        && fwrite(palette, sizeof(uint32_t), colors, stream) == colors
+        && fwrite(indexes, sizeof(uint8_t), count, stream) == count;
+    fclose(stream);
+    free(indexes);
+
+    if (!result) {
+        fprintf(stderr, "can't write file `%s`\n", output);
+        return false;
+    }
+
+    fprintf(stdout, "file `%s` converted to `%s` (%dx%d, %lu colors)\n", input, output, width, height, (unsigned long)colors);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <input> <output>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return convert(argv[1], argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
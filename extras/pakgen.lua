@@ -31,7 +31,20 @@ local lfs = require("lfs")
 local luazen = require("luazen")
 local struct = require("struct")
 
-local VERSION = 0x0000
+local VERSION = 0x01
+
+local FLAG_ENCRYPTED = 0x0001
+
+local ENTRY_FLAG_COMPRESSED = 0x0001
+
+local BLOCK_SIZE = 65536
+local BLOCK_FLAG_STORED = 0x80000000
+
+-- LZ4 block-format constants, the last sequence needs to be literals-only.
+local LZ_MIN_MATCH = 4
+local LZ_MAX_OFFSET = 65535
+local LZ_LAST_LITERALS = 5
+local LZ_MATCH_FIND_LIMIT = 12
 
 function string:at(index)
   return self:sub(index, index)
@@ -72,14 +85,88 @@ local function attrdir(path, list)
   end
 end
 
+local function lz_length(chunks, length)
+  while length >= 255 do
+    table.insert(chunks, string.char(255))
+    length = length - 255
+  end
+  table.insert(chunks, string.char(length))
+end
+
+local function lz_sequence(chunks, literals, offset, match)
+  local literals_length = #literals
+  local token_literals = literals_length < 15 and literals_length or 15
+  local token_match = 0
+  if offset then
+    token_match = match - LZ_MIN_MATCH < 15 and match - LZ_MIN_MATCH or 15
+  end
+  table.insert(chunks, string.char(token_literals * 16 + token_match))
+  if literals_length >= 15 then
+    lz_length(chunks, literals_length - 15)
+  end
+  table.insert(chunks, literals)
+  if offset then
+    table.insert(chunks, string.char(offset % 256, math.floor(offset / 256)))
+    if match - LZ_MIN_MATCH >= 15 then
+      lz_length(chunks, match - LZ_MIN_MATCH - 15)
+    end
+  end
+end
+
+-- Greedy LZ4 block compressor, matches are found by indexing the last occurrence of each 4-bytes sequence.
+local function lz_compress(data)
+  local chunks = {}
+  local positions = {}
+  local length = #data
+  local limit = length - LZ_LAST_LITERALS
+  local anchor = 1
+  local index = 1
+  while index <= length - LZ_MATCH_FIND_LIMIT + 1 do
+    local key = data:sub(index, index + LZ_MIN_MATCH - 1)
+    local candidate = positions[key]
+    positions[key] = index
+    if candidate and index - candidate <= LZ_MAX_OFFSET then
+      local match = LZ_MIN_MATCH
+      while index + match <= limit and data:byte(candidate + match) == data:byte(index + match) do
+        match = match + 1
+      end
+      lz_sequence(chunks, data:sub(anchor, index - 1), index - candidate, match)
+      index = index + match
+      anchor = index
+    else
+      index = index + 1
+    end
+  end
+  lz_sequence(chunks, data:sub(anchor))
+  return table.concat(chunks)
+end
+
+-- Each block is prefixed by its size, and stored as-is when compression doesn't pay off.
+local function compress(content)
+  local chunks = {}
+  for offset = 1, #content, BLOCK_SIZE do
+    local block = content:sub(offset, offset + BLOCK_SIZE - 1)
+    local packed = lz_compress(block)
+    if #packed < #block then
+      table.insert(chunks, struct.pack("I4", #packed))
+      table.insert(chunks, packed)
+    else
+      table.insert(chunks, struct.pack("I4", #block + BLOCK_FLAG_STORED))
+      table.insert(chunks, block)
+    end
+  end
+  return table.concat(chunks)
+end
+
 local function emit_header(output, config, files)
-  local flags = bit32.lshift(config.encrypted and 1 or 0, 0)
+  local flags = bit32.lshift(config.encrypted and FLAG_ENCRYPTED or 0, 0)
 
   output:write(struct.pack("c8", "TOFUPAK!"))
   output:write(struct.pack("I1", VERSION))
   output:write(struct.pack("I1", flags))
   output:write(struct.pack("I2", 0xFFFF))
   output:write(struct.pack("I4", #files))
+  output:write(struct.pack("I4", 0)) -- Directory offset, patched once the entries are written.
 end
 
 local function emit_entry(output, file, config)
@@ -87,24 +174,50 @@ local function emit_entry(output, file, config)
 
   local content = input:read("*all")
 
+  input:close()
+
+  file.flags = 0
+  file.offset = output:seek()
+
+  if config.compressed then
+    local packed = compress(content)
+    if #packed < #content then
+      content = packed
+      file.flags = bit32.bor(file.flags, ENTRY_FLAG_COMPRESSED)
+    end
+  end
+
   if config.encrypted then
     content = luazen.rc4raw(content, luazen.md5(file.name))
   end
 
-  output:write(struct.pack("I2", 0xFFFF))
-  output:write(struct.pack("I2", #file.name))
-  output:write(struct.pack("I4", file.size))
-  output:write(struct.pack("c0", file.name))
+  file.stored = #content
+
   output:write(content)
+end
 
-  input:close()
+local function emit_directory(output, files)
+  local offset = output:seek()
+
+  for _, file in ipairs(files) do
+    output:write(struct.pack("I2", file.flags))
+    output:write(struct.pack("I2", #file.name))
+    output:write(struct.pack("I4", file.offset))
+    output:write(struct.pack("I4", file.size))
+    output:write(struct.pack("I4", file.stored))
+    output:write(struct.pack("c0", file.name))
+  end
+
+  output:seek("set", 16)
+  output:write(struct.pack("I4", offset))
 end
 
 local function parse_arguments(args)
   local config = {
       input = nil,
       output = nil,
-      encrypted = false
+      encrypted = false,
+      compressed = false
     }
   for _, arg in ipairs(args) do
     if arg:starts_with("--input=") then
@@ -119,6 +232,8 @@ local function parse_arguments(args)
       end
     elseif arg:starts_with("--encrypted") then
       config.encrypted = true
+    elseif arg:starts_with("--compressed") then
+      config.compressed = true
     end
   end
   return (config.input and config.output) and config or nil
@@ -136,7 +251,7 @@ end
 
 local config = parse_arguments(arg)
 if not config then
-  print("Usage: pakgen --input=<input folder> --output=<output file> [--encrypted]")
+  print("Usage: pakgen --input=<input folder> --output=<output file> [--encrypted] [--compressed]")
   return
 end
 
@@ -144,6 +259,9 @@ local flags = {}
 if config.encrypted then
   table.insert(flags, "encrypted")
 end
+if config.compressed then
+  table.insert(flags, "compressed")
+end
 local annotation = #flags == 0 and "plain" or table.concat(flags, " and ")
 
 local files = fetch_files(config.input)
@@ -155,8 +273,9 @@ emit_header(output, config, files)
 for index, file in ipairs(files) do
   emit_entry(output, file, config)
 
-  print(string.format("  [%d] `%s` %d", index - 1, file.name, file.size))
+  print(string.format("  [%d] `%s` %d (%d stored)", index - 1, file.name, file.size, file.stored))
 end
+emit_directory(output, files)
 
 output:close()
 print("Done!")
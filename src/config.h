@@ -28,6 +28,8 @@
 
 #define GARBAGE_COLLECTION_PERIOD   60.0
 
+#define PAK_READ_AHEAD_SIZE         16384
+
 // Behavioural MACROs use the `__` prefix/suffix.
 #define __GL_VERSION__                      0x0201
 #define __GSLS_VERSION__                    0x0114
@@ -52,6 +54,9 @@
 #define __DEBUG_GARBAGE_COLLECTOR__
 #define __VM_USE_CUSTOM_TRACEBACK__
 #undef  __GL_MASK_SUPPORT__
+#define __GL_SIMD_SUPPORT__
+#define __GL_DEFERRED_SUPPORT__
+#define __GL_SHEET_REPACKING__
 
 // In release build, disable VM calls debug for faster execution.
 #ifdef RELEASE
@@ -50,6 +50,12 @@ static void on_parameter(Configuration_t *configuration, const char *key, const
     if (strcmp(key, "vertical-sync") == 0) {
         configuration->vertical_sync = strcmp(value, "true") == 0;
     } else
+    if (strcmp(key, "render-workers") == 0) {
+        configuration->render_workers = (size_t)strtoul(value, NULL, 0);
+    } else
+    if (strcmp(key, "loader-workers") == 0) {
+        configuration->loader_workers = (size_t)strtoul(value, NULL, 0);
+    } else
     if (strcmp(key, "fps") == 0) {
         configuration->fps = (size_t)strtoul(value, NULL, 0);
         configuration->skippable_frames = configuration->fps / 5; // Keep synched. About 20% of the FPS amount.
@@ -161,6 +167,8 @@ void Configuration_load(Configuration_t *configuration, const char *data)
             .scale = 0,
             .fullscreen = false,
             .vertical_sync = false,
+            .render_workers = 0,
+            .loader_workers = 1,
             .fps = 60,
             .skippable_frames = 3, // About 20% of the FPS amount.
             .fps_cap = -1, // No capping as a default. TODO: make it run-time configurable?
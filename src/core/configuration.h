@@ -35,6 +35,8 @@ typedef struct _Configuration {
     size_t width, height, scale;
     bool fullscreen;  // TODO: rename to "windowed"?
     bool vertical_sync;
+    size_t render_workers; // Additional threads drawing the canvas in bands, zero to draw immediately.
+    size_t loader_workers; // Threads loading assets in background, zero to load them on the main thread (one per frame).
     size_t fps; // TODO: rename to "frequency"?
     size_t skippable_frames;
     size_t fps_cap;
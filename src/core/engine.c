@@ -129,7 +129,8 @@ bool Engine_initialize(Engine_t *engine, const char *base_path)
             .fullscreen = engine->configuration.fullscreen,
             .vertical_sync = engine->configuration.vertical_sync,
             .scale = engine->configuration.scale,
-            .hide_cursor = engine->configuration.hide_cursor
+            .hide_cursor = engine->configuration.hide_cursor,
+            .workers = engine->configuration.render_workers
         };
     result = Display_initialize(&engine->display, &display_configuration);
     if (!result) {
@@ -172,6 +173,16 @@ bool Engine_initialize(Engine_t *engine, const char *base_path)
         return false;
     }
 
+    result = Loader_initialize(&engine->loader, &engine->file_system, engine->configuration.loader_workers);
+    if (!result) {
+        Log_write(LOG_LEVELS_FATAL, LOG_CONTEXT, "can't initialize loader");
+        Audio_terminate(&engine->audio);
+        Input_terminate(&engine->input);
+        Display_terminate(&engine->display);
+        FS_terminate(&engine->file_system);
+        return false;
+    }
+
     // The interpreter is the first to be loaded, since it also manages the configuration. Later on, we will call to
     // initialization function once the sub-systems are ready.
     const void *userdatas[] = {
@@ -180,11 +191,13 @@ bool Engine_initialize(Engine_t *engine, const char *base_path)
             &engine->environment,
             &engine->display,
             &engine->input,
+            &engine->loader,
             NULL
         };
     result = Interpreter_initialize(&engine->interpreter, &engine->file_system, userdatas);
     if (!result) {
         Log_write(LOG_LEVELS_FATAL, LOG_CONTEXT, "can't initialize interpreter");
+        Loader_terminate(&engine->loader);
         Audio_terminate(&engine->audio);
         Input_terminate(&engine->input);
         Display_terminate(&engine->display);
@@ -198,6 +211,7 @@ bool Engine_initialize(Engine_t *engine, const char *base_path)
 void Engine_terminate(Engine_t *engine)
 {
     Interpreter_terminate(&engine->interpreter); // Terminate the interpreter to unlock all resources.
+    Loader_terminate(&engine->loader); // Once the interpreter has released the jobs, as it's submitting them.
     Audio_terminate(&engine->audio);
     Display_terminate(&engine->display);
     Input_terminate(&engine->input);
@@ -241,6 +255,8 @@ void Engine_run(Engine_t *engine)
 
         Input_process(&engine->input);
 
+        Loader_update(&engine->loader); // Hand the loaded assets back, prior processing the frame.
+
         running = running && Interpreter_process(&engine->interpreter); // Lazy evaluate `running`, will avoid calls when error.
 
         lag += elapsed; // Count a maximum amount of skippable frames in order no to stall on slower machines.
@@ -29,6 +29,7 @@
 #include <core/io/audio.h>
 #include <core/io/display.h>
 #include <core/io/input.h>
+#include <core/io/loader.h>
 #include <core/vm/interpreter.h>
 #include <libs/fs/fs.h>
 
@@ -48,6 +49,7 @@ typedef struct _Engine_t {
     Audio_t audio;
     Display_t display;
     Input_t input;
+    Loader_t loader;
 
     Environment_t environment;
 } Engine_t;
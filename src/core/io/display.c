@@ -30,6 +30,7 @@
 #include <libs/stb.h>
 
 #include <memory.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #define LOG_CONTEXT "display"
@@ -49,6 +50,7 @@ typedef enum Uniforms_t {
     UNIFORM_TEXTURE,
     UNIFORM_RESOLUTION,
     UNIFORM_TIME,
+    UNIFORM_PALETTE, // Palette program only, must be the last one.
     Uniforms_t_CountOf
 } Uniforms_t;
 
@@ -83,6 +85,28 @@ typedef enum Uniforms_t {
     "    gl_FragColor = passthru(gl_Color, u_texture0, v_texture_coords, gl_FragCoord.xy);\n" \
     "}\n"
 
+// The indexes texture stores `index / 255` in its single channel; it's scaled back and used to address the center of
+// the corresponding texel of the (256 entries wide) palette texture.
+#define FRAGMENT_SHADER_PALETTE \
+    "#version 120\n" \
+    "\n" \
+    "varying vec2 v_texture_coords;\n" \
+    "\n" \
+    "uniform sampler2D u_texture0;\n" \
+    "uniform vec2 u_resolution;\n" \
+    "uniform float u_time;\n" \
+    "uniform sampler2D u_palette;\n" \
+    "\n" \
+    "vec4 palette(vec4 color, sampler2D texture, vec2 texture_coords, vec2 screen_coords) {\n" \
+    "    float index = texture2D(texture, texture_coords).r * 255.0;\n" \
+    "    return texture2D(u_palette, vec2((index + 0.5) / 256.0, 0.5)) * color;\n" \
+    "}\n" \
+    "\n" \
+    "void main()\n" \
+    "{\n" \
+    "    gl_FragColor = palette(gl_Color, u_texture0, v_texture_coords, gl_FragCoord.xy);\n" \
+    "}\n"
+
 #define FRAGMENT_SHADER_CUSTOM \
     "#version 120\n" \
     "\n" \
@@ -102,15 +126,18 @@ typedef enum Uniforms_t {
 
 static const Program_Data_t _programs_data[Display_Programs_t_CountOf] = {
     { VERTEX_SHADER, FRAGMENT_SHADER_PASSTHRU },
+    { VERTEX_SHADER, FRAGMENT_SHADER_PALETTE },
     { NULL, NULL }
 };
 
 static const int _texture_id_0 = 0;
+static const int _texture_id_1 = 1;
 
 static const char *_uniforms[Uniforms_t_CountOf] = {
     "u_texture0",
     "u_resolution",
     "u_time",
+    "u_palette"
 };
 
 static const unsigned char _window_icon_pixels[] = {
@@ -125,7 +152,23 @@ static void set_icon(GLFWwindow *window, File_System_Chunk_t icon)
         return;
     }
 
-    glfwSetWindowIcon(window, 1, &(GLFWimage){ .width = icon.var.image.width, .height = icon.var.image.height, .pixels = icon.var.image.pixels });
+    if (icon.var.image.colors > 0) { // Pre-indexed icons are expanded back to RGBA, as GLFW requires.
+        size_t count = icon.var.image.width * icon.var.image.height;
+        uint32_t *pixels = malloc(count * sizeof(uint32_t));
+        if (!pixels) {
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't allocate %dx%d icon", icon.var.image.width, icon.var.image.height);
+            return;
+        }
+        const uint8_t *palette = (const uint8_t *)icon.var.image.palette; // Might be unaligned, when mapped.
+        const uint8_t *indexes = (const uint8_t *)icon.var.image.pixels;
+        for (size_t i = 0; i < count; ++i) { // Indexes are checked against the palette when loading.
+            memcpy(&pixels[i], palette + indexes[i] * 4, sizeof(uint32_t));
+        }
+        glfwSetWindowIcon(window, 1, &(GLFWimage){ .width = icon.var.image.width, .height = icon.var.image.height, .pixels = (unsigned char *)pixels });
+        free(pixels);
+    } else {
+        glfwSetWindowIcon(window, 1, &(GLFWimage){ .width = icon.var.image.width, .height = icon.var.image.height, .pixels = icon.var.image.pixels });
+    }
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "setting custom %dx%d icon", icon.var.image.width, icon.var.image.height);
 }
 
@@ -152,6 +195,77 @@ static bool has_errors(void)
 }
 #endif
 
+static GLuint create_texture(size_t width, size_t height, GLint internal_format, GLenum format)
+{
+    GLuint id;
+    glGenTextures(1, &id);
+    if (id == 0) {
+        return 0;
+    }
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Mandatory for the indexes/palette lookup.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0); // Disable mip-mapping
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "texture created w/ id #%d (%dx%d)", id, width, height);
+    return id;
+}
+
+static void delete_textures(Display_t *display)
+{
+    const GLuint textures[] = { display->vram_texture, display->indexes_texture, display->palette_texture };
+    glDeleteTextures(3, textures); // Zeroes are silently ignored.
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "textures #%d, #%d, and #%d deleted", textures[0], textures[1], textures[2]);
+}
+
+// Pixel-buffer-objects are available since OpenGL 2.1, each one is large enough to hold the whole RGBA buffer.
+static void create_buffers(Display_t *display)
+{
+    if (!GLAD_GL_VERSION_2_1) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "pixel-buffer-objects not supported, uploading synchronously");
+        return;
+    }
+    glGenBuffers(DISPLAY_VRAM_BUFFERS, display->vram_buffers);
+    for (size_t i = 0; i < DISPLAY_VRAM_BUFFERS; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display->vram_buffers[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, display->vram_size, NULL, GL_STREAM_DRAW);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "pixel-buffer-object w/ id #%d created (%d bytes)", display->vram_buffers[i], display->vram_size);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // Unbound when not uploading, to not interfere with client-memory uploads.
+}
+
+// Map the next buffer of the ring, the one used `DISPLAY_VRAM_BUFFERS - 1` frames ago, so that (most likely) the
+// driver has already consumed it and there's no need to wait. The storage is orphaned prior mapping it, so that
+// should it still be in use the driver can hand a fresh one instead of stalling. On success the buffer is left bound.
+static void *map_buffer(Display_t *display)
+{
+    const GLuint id = display->vram_buffers[display->vram_buffer_index];
+    if (id == 0) {
+        return NULL;
+    }
+    display->vram_buffer_index = (display->vram_buffer_index + 1) % DISPLAY_VRAM_BUFFERS;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, display->vram_size, NULL, GL_STREAM_DRAW); // `glMapBufferRange()` is GL 3.0+.
+    void *pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (!pixels) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't map pixel-buffer-object #%d, uploading synchronously", id);
+    }
+    return pixels;
+}
+
+// The palette program is used (when available) with no custom effect, the indexed buffer is uploaded as-is and
+// resolved on the GPU. Custom effects sample the RGBA texture, so the CPU conversion is retained for them.
+static inline bool is_indexed(const Display_t *display)
+{
+    return display->active_program == &display->programs[DISPLAY_PROGRAM_PALETTE];
+}
+
 static bool compute_size(Display_t *display, const Display_Configuration_t *configuration, GL_Point_t *position)
 {
     int display_width, display_height;
@@ -317,38 +431,44 @@ bool Display_initialize(Display_t *display, const Display_Configuration_t *confi
         return false;
     }
 
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (configuration->workers > 0 && !GL_context_defer(&display->gl, configuration->workers)) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't defer GL, drawing immediately");
+    }
+#endif
+
     GL_palette_greyscale(&display->palette, GL_MAX_PALETTE_COLORS);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "calculating greyscale palette of #%d entries", GL_MAX_PALETTE_COLORS);
 
-    display->vram_size = display->configuration.width * display->configuration.width * sizeof(GL_Color_t);
+    display->vram_size = display->configuration.width * display->configuration.height * sizeof(GL_Color_t);
     display->vram = malloc(display->vram_size);
     if (!display->vram) {
         Log_write(LOG_LEVELS_FATAL, LOG_CONTEXT, "can't allocate VRAM buffer");
         GL_context_delete(&display->gl);
         glfwDestroyWindow(display->window);
         glfwTerminate();
+        return false;
     }
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "%d bytes VRAM allocated at %p (%dx%d)", display->vram_size, display->vram, display->configuration.width, display->configuration.height);
 
-    glGenTextures(1, &display->vram_texture); //allocate the memory for texture
-    if (display->vram_texture == 0) {
-        Log_write(LOG_LEVELS_FATAL, LOG_CONTEXT, "can't allocate VRAM texture");
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Indexes rows are byte-sized, and not necessarily a multiple of 4 wide.
+
+    glActiveTexture(GL_TEXTURE1);
+    display->palette_texture = create_texture(GL_MAX_PALETTE_COLORS, 1, GL_RGBA, PIXEL_FORMAT); // Stays bound to unit #1.
+    glActiveTexture(GL_TEXTURE0);
+    display->indexes_texture = create_texture(display->configuration.width, display->configuration.height, GL_LUMINANCE8, GL_LUMINANCE);
+    display->vram_texture = create_texture(display->configuration.width, display->configuration.height, GL_RGBA, PIXEL_FORMAT);
+    if (display->vram_texture == 0 || display->indexes_texture == 0 || display->palette_texture == 0) {
+        Log_write(LOG_LEVELS_FATAL, LOG_CONTEXT, "can't allocate VRAM textures");
+        delete_textures(display);
         free(display->vram);
         GL_context_delete(&display->gl);
         glfwDestroyWindow(display->window);
         glfwTerminate();
         return false;
     }
-    glBindTexture(GL_TEXTURE_2D, display->vram_texture); // The VRAM texture is always the active and bound one.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0); // Disable mip-mapping
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, display->configuration.width, display->configuration.height, 0, PIXEL_FORMAT, GL_UNSIGNED_BYTE, NULL);
-    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "texture created w/ id #%d (%dx%d)", display->vram_texture, display->configuration.width, display->configuration.height);
+
+    create_buffers(display);
 
     for (size_t i = 0; i < Display_Programs_t_CountOf; ++i) {
         const Program_Data_t *data = &_programs_data[i];
@@ -359,11 +479,17 @@ bool Display_initialize(Display_t *display, const Display_Configuration_t *confi
         if (!program_create(program) ||
             !program_attach(program, data->vertex_shader, PROGRAM_SHADER_VERTEX) ||
             !program_attach(program, data->fragment_shader, PROGRAM_SHADER_FRAGMENT)) {
+            if (i == DISPLAY_PROGRAM_PALETTE) { // Not fatal, we can still convert the buffer on the CPU.
+                Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't initialize palette shader, falling back to CPU conversion");
+                program_delete(program);
+                continue;
+            }
             Log_write(LOG_LEVELS_FATAL, LOG_CONTEXT, "can't initialize shaders");
             for (size_t j = 0; j < i; ++j) {
                 program_delete(&display->programs[j]);
             }
-            glDeleteBuffers(1, &display->vram_texture);
+            glDeleteBuffers(DISPLAY_VRAM_BUFFERS, display->vram_buffers);
+            delete_textures(display);
             free(display->vram);
             GL_context_delete(&display->gl);
             glfwDestroyWindow(display->window);
@@ -371,10 +497,11 @@ bool Display_initialize(Display_t *display, const Display_Configuration_t *confi
             return false;
         }
 
-        program_prepare(program, _uniforms, Uniforms_t_CountOf);
+        program_prepare(program, _uniforms, i == DISPLAY_PROGRAM_PALETTE ? Uniforms_t_CountOf : UNIFORM_PALETTE);
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "program %p prepared w/ id #%d", program, program->id);
     }
 
+    Display_palette(display, &display->palette); // Upload the initial palette.
     Display_shader(display, NULL); // Use pass-thru at the beginning.
 
 #ifdef DEBUG
@@ -393,8 +520,10 @@ void Display_terminate(Display_t *display)
         program_delete(&display->programs[i]);
     }
 
-    glDeleteBuffers(1, &display->vram_texture);
-    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "texture w/ id #%d deleted", display->vram_texture);
+    glDeleteBuffers(DISPLAY_VRAM_BUFFERS, display->vram_buffers); // Zeroes are silently ignored.
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "pixel-buffer-objects deleted");
+
+    delete_textures(display);
 
     free(display->vram);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "VRAM buffer %p deallocated", display->vram);
@@ -435,14 +564,46 @@ void Display_offset(Display_t *display, GL_Point_t offset)
     display->vram_offset = offset;
 }
 
-void Display_present(const Display_t *display)
+void Display_present(Display_t *display)
 {
     const GL_Surface_t *buffer = &display->gl.buffer;
     GL_Color_t *vram = display->vram;
 
-    GL_surface_to_rgba(buffer, &display->palette, vram);
-
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buffer->width, buffer->height, PIXEL_FORMAT, GL_UNSIGNED_BYTE, vram);
+    // Only the rows changed since the last frame are converted and uploaded (the pending deferred drawing commands,
+    // if any, are completed first). Rows are used, rather than rectangles, so that uploaded data is contiguous.
+    GL_Quad_t dirty;
+    if (GL_context_collect_dirty(&display->gl, &dirty)) {
+        const size_t first = (size_t)dirty.y0;
+        const size_t count = (size_t)(dirty.y1 - dirty.y0 + 1);
+
+        // When a pixel-buffer-object is mapped, rows are written into it and the texture update is asynchronous,
+        // with the pointer argument being an offset into the bound buffer.
+        void *pixels = map_buffer(display);
+        if (is_indexed(display)) { // Indexes are uploaded as they are, a quarter of the data and no conversion.
+            const size_t offset = first * buffer->width * sizeof(GL_Pixel_t);
+            const void *data = buffer->data + first * buffer->width;
+            if (pixels) {
+                memcpy((uint8_t *)pixels + offset, data, count * buffer->width * sizeof(GL_Pixel_t));
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                data = (const void *)(uintptr_t)offset;
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)first, buffer->width, count, GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+        } else {
+            const size_t offset = first * buffer->width * sizeof(GL_Color_t);
+            const void *data = vram + first * buffer->width;
+            if (pixels) {
+                GL_context_to_rgba_rows(&display->gl, &display->palette, (GL_Color_t *)pixels, first, count);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                data = (const void *)(uintptr_t)offset;
+            } else {
+                GL_context_to_rgba_rows(&display->gl, &display->palette, vram, first, count);
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)first, buffer->width, count, PIXEL_FORMAT, GL_UNSIGNED_BYTE, data);
+        }
+        if (pixels) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+    }
 
     // Add an offset x/y to implement shaking and similar effects.
     const GL_Quad_t *vram_destination = &display->vram_destination;
@@ -471,7 +632,10 @@ void Display_present(const Display_t *display)
 
 void Display_shader(Display_t *display, const char *effect)
 {
-    bool is_passthru = display->active_program == &display->programs[DISPLAY_PROGRAM_PASSTHRU];
+    Program_t *passthru = display->programs[DISPLAY_PROGRAM_PALETTE].id != 0
+        ? &display->programs[DISPLAY_PROGRAM_PALETTE]
+        : &display->programs[DISPLAY_PROGRAM_PASSTHRU];
+    bool is_passthru = display->active_program == passthru;
 
     if (!is_passthru) {
         if (display->active_program) {
@@ -485,8 +649,7 @@ void Display_shader(Display_t *display, const char *effect)
 
     if (!effect) {
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "loading pass-thru shader");
-        program_delete(&display->programs[DISPLAY_PROGRAM_CUSTOM]);
-        display->active_program = &display->programs[DISPLAY_PROGRAM_PASSTHRU];
+        display->active_program = passthru;
     } else {
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "loading custom shader");
         const size_t length = strlen(FRAGMENT_SHADER_CUSTOM) + strlen(effect);
@@ -504,6 +667,7 @@ void Display_shader(Display_t *display, const char *effect)
         } else {
             program_delete(program);
             Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't load custom shader");
+            display->active_program = passthru;
         }
 
         free(code);
@@ -515,13 +679,29 @@ void Display_shader(Display_t *display, const char *effect)
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "program %p active", display->active_program);
 
     program_send(display->active_program, UNIFORM_TEXTURE, PROGRAM_UNIFORM_TEXTURE, 1, &_texture_id_0); // Redundant
+    if (is_indexed(display)) {
+        program_send(display->active_program, UNIFORM_PALETTE, PROGRAM_UNIFORM_TEXTURE, 1, &_texture_id_1);
+    }
     GLfloat resolution[] = { (GLfloat)display->window_width, (GLfloat)display->window_height };
     program_send(display->active_program, UNIFORM_RESOLUTION, PROGRAM_UNIFORM_VEC2, 1, resolution);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "program %p initialized", display->active_program);
+
+    // Switching between the indexed and the RGBA textures, the newly bound one is stale and needs a full upload.
+    glBindTexture(GL_TEXTURE_2D, is_indexed(display) ? display->indexes_texture : display->vram_texture);
+    GL_context_dirty(&display->gl, NULL);
 }
 
 void Display_palette(Display_t *display, const GL_Palette_t *palette)
 {
     display->palette = *palette;
+
+    // The lookup texture is always kept in sync (it's just 1KB), so that the shader can be switched at any time.
+    glActiveTexture(GL_TEXTURE1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GL_MAX_PALETTE_COLORS, 1, PIXEL_FORMAT, GL_UNSIGNED_BYTE, display->palette.colors);
+    glActiveTexture(GL_TEXTURE0);
+
+    if (!is_indexed(display)) {
+        GL_context_dirty(&display->gl, NULL); // Every pixel changes color, the whole buffer needs to be converted again.
+    }
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "palette updated");
 }
@@ -40,11 +40,14 @@
 typedef enum _Display_Programs_t {
     Display_Programs_t_First = 0,
     DISPLAY_PROGRAM_PASSTHRU = Display_Programs_t_First,
+    DISPLAY_PROGRAM_PALETTE,
     DISPLAY_PROGRAM_CUSTOM,
     Display_Programs_t_Last = DISPLAY_PROGRAM_CUSTOM,
     Display_Programs_t_CountOf
 } Display_Programs_t;
 
+#define DISPLAY_VRAM_BUFFERS    3 // Triple-buffered pixel-buffer-objects ring.
+
 typedef struct _Display_Configuration_t {
     const char *title;
     File_System_Chunk_t icon;
@@ -53,6 +56,7 @@ typedef struct _Display_Configuration_t {
     bool fullscreen;
     bool vertical_sync;
     bool hide_cursor;
+    size_t workers;
 } Display_Configuration_t;
 
 typedef struct _Display_t {
@@ -65,6 +69,10 @@ typedef struct _Display_t {
     GL_Color_t *vram; // Temporary buffer to create the OpenGL texture from `GL_Pixel_t` array.
     size_t vram_size;
     GLuint vram_texture;
+    GLuint indexes_texture; // Single-channel copy of the `GL_Pixel_t` buffer, resolved by the palette shader.
+    GLuint palette_texture; // 256x1 palette lookup texture, bound to texture-unit #1.
+    GLuint vram_buffers[DISPLAY_VRAM_BUFFERS]; // Zeroed when not available, uploads are synchronous in that case.
+    size_t vram_buffer_index;
     GL_Quad_t vram_destination;
     GL_Point_t vram_offset;
 
@@ -82,7 +90,7 @@ extern bool Display_should_close(const Display_t *display);
 extern void Display_update(Display_t *display, float delta_time);
 extern void Display_clear(const Display_t *display);
 extern void Display_offset(Display_t *display, GL_Point_t offset);
-extern void Display_present(const Display_t *display);
+extern void Display_present(Display_t *display);
 
 extern void Display_shader(Display_t *display, const char *code);
 extern void Display_palette(Display_t *display, const GL_Palette_t *palette);
@@ -65,6 +65,8 @@ void program_delete(Program_t *program)
 
     free(program->locations); // Safe when passing NULL.
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "shader uniforms LUT for program #%d deleted", program->id);
+
+    *program = (Program_t){ 0 };
 }
 
 bool program_attach(Program_t *program, const char *shader_code, Program_Shaders_t shader_type)
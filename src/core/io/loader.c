@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#include "loader.h"
+
+#include <config.h>
+#include <libs/log.h>
+#include <libs/stb.h>
+
+#include <string.h>
+
+#define LOG_CONTEXT "loader"
+
+// Same as `arrsetlen(a, 0)`, which can't be used with a zero length due to the (signedness) warnings.
+#define ARRAY_RESET(a)  ((a) ? stbds_header(a)->length = 0 : 0)
+
+static bool _execute(const File_System_t *file_system, Loader_Job_t *job)
+{
+    File_System_Chunk_t chunk = FS_load(file_system, job->file, FILE_SYSTEM_CHUNK_IMAGE);
+    if (chunk.type == FILE_SYSTEM_CHUNK_NULL) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't load file `%s`", job->file);
+        return false;
+    }
+
+    const GL_Image_t image = (GL_Image_t){
+            .width = chunk.var.image.width,
+            .height = chunk.var.image.height,
+            .data = chunk.var.image.pixels,
+            .palette = chunk.var.image.palette,
+            .colors = chunk.var.image.colors
+        };
+
+    bool result = false;
+    if (job->type == LOADER_JOB_SURFACE) {
+        result = GL_surface_fetch(&job->var.surface, image, job->callback, (void *)&job->palette);
+    } else
+    if (job->type == LOADER_JOB_SHEET) {
+        result = GL_sheet_fetch(&job->var.sheet, image, job->cell_width, job->cell_height, job->callback, (void *)&job->palette);
+#ifdef __GL_SHEET_REPACKING__
+        if (result && !GL_sheet_repack(&job->var.sheet)) { // The atlas is owned, lay the cells out contiguously.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't repack sheet `%s`", job->file);
+        }
+#endif
+        if (result && !GL_sheet_trim(&job->var.sheet, &job->transparency)) {
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't trim sheet `%s`", job->file);
+        }
+    }
+    FS_release(chunk);
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "job %p `%s` executed (%s)", job, job->file, result ? "succeeded" : "failed");
+
+    return result;
+}
+
+static void _delete(Loader_Job_t *job)
+{
+    if (job->succeeded && !job->claimed) {
+        if (job->type == LOADER_JOB_SURFACE) {
+            GL_surface_delete(&job->var.surface);
+        } else
+        if (job->type == LOADER_JOB_SHEET) {
+            GL_sheet_delete(&job->var.sheet);
+        }
+    }
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "job %p deleted", job);
+    free(job);
+}
+
+static void _remove(Loader_Job_t **jobs, const Loader_Job_t *job)
+{
+    size_t count = arrlen(jobs);
+    for (size_t i = 0; i < count; ++i) {
+        if (jobs[i] == job) {
+            arrdel(jobs, i);
+            return;
+        }
+    }
+}
+
+static void *_worker(void *arg)
+{
+    Loader_t *loader = (Loader_t *)arg;
+
+    pthread_mutex_lock(&loader->mutex);
+    for (;;) {
+        while (!loader->quit && arrlen(loader->queued) == 0) {
+            pthread_cond_wait(&loader->available, &loader->mutex);
+        }
+        if (loader->quit) {
+            break;
+        }
+        Loader_Job_t *job = loader->queued[0]; // First come, first served.
+        arrdel(loader->queued, 0);
+        job->state = LOADER_JOB_STATE_RUNNING;
+        pthread_mutex_unlock(&loader->mutex);
+
+        bool succeeded = _execute(loader->file_system, job);
+
+        pthread_mutex_lock(&loader->mutex);
+        job->succeeded = succeeded;
+        job->state = LOADER_JOB_STATE_FINISHED;
+        arrpush(loader->finished, job);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+
+    return NULL;
+}
+
+bool Loader_initialize(Loader_t *loader, const File_System_t *file_system, size_t workers)
+{
+    *loader = (Loader_t){ .file_system = file_system };
+
+#ifdef DEBUG
+    if (workers > 0) { // The leak-checking allocator isn't thread-safe.
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "debug build, jobs will be executed on the main thread");
+        workers = 0;
+    }
+#endif
+
+    loader->workers = malloc(workers * sizeof(pthread_t));
+    if (!loader->workers && workers > 0) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate workers");
+        return false;
+    }
+
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->available, NULL);
+
+    for (size_t i = 0; i < workers; ++i) {
+        if (pthread_create(&loader->workers[i], NULL, _worker, loader) != 0) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't create worker #%d", (int)i);
+            Loader_terminate(loader);
+            return false;
+        }
+        loader->count += 1;
+    }
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "loader initialized w/ %d workers", (int)loader->count);
+    return true;
+}
+
+void Loader_terminate(Loader_t *loader)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->quit = true;
+    pthread_cond_broadcast(&loader->available);
+    pthread_mutex_unlock(&loader->mutex);
+
+    for (size_t i = 0; i < loader->count; ++i) {
+        pthread_join(loader->workers[i], NULL);
+    }
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "%d workers joined", (int)loader->count);
+
+    pthread_cond_destroy(&loader->available);
+    pthread_mutex_destroy(&loader->mutex);
+
+    free(loader->workers);
+
+    // Jobs still pending (or never released) are deleted along with their results.
+    Loader_Job_t **lists[] = { loader->queued, loader->finished, loader->completed };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(Loader_Job_t **); ++i) {
+        size_t count = arrlen(lists[i]);
+        for (size_t j = 0; j < count; ++j) {
+            _delete(lists[i][j]);
+        }
+        arrfree(lists[i]);
+    }
+}
+
+// This is the safe point where jobs are handed back to the main thread. Lacking workers, a single job is executed
+// per update, so that the loading is spread along several frames anyway.
+void Loader_update(Loader_t *loader)
+{
+    if (loader->count == 0 && arrlen(loader->queued) > 0) {
+        Loader_Job_t *job = loader->queued[0];
+        arrdel(loader->queued, 0);
+        job->succeeded = _execute(loader->file_system, job);
+        job->state = LOADER_JOB_STATE_FINISHED;
+        arrpush(loader->finished, job);
+    }
+
+    pthread_mutex_lock(&loader->mutex);
+    size_t count = arrlen(loader->finished);
+    for (size_t i = 0; i < count; ++i) {
+        Loader_Job_t *job = loader->finished[i];
+        if (job->abandoned) {
+            _delete(job);
+            continue;
+        }
+        job->state = LOADER_JOB_STATE_COMPLETED;
+        job->completed = true;
+        arrpush(loader->completed, job);
+    }
+    ARRAY_RESET(loader->finished);
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+Loader_Job_t *Loader_submit(Loader_t *loader, const Loader_Job_t *job)
+{
+    Loader_Job_t *instance = malloc(sizeof(Loader_Job_t));
+    if (!instance) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate job for file `%s`", job->file);
+        return NULL;
+    }
+    *instance = *job;
+    instance->state = LOADER_JOB_STATE_QUEUED;
+    instance->abandoned = false;
+    instance->completed = false;
+    instance->succeeded = false;
+    instance->claimed = false;
+
+    pthread_mutex_lock(&loader->mutex);
+    arrpush(loader->queued, instance);
+    pthread_cond_signal(&loader->available);
+    pthread_mutex_unlock(&loader->mutex);
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "job %p `%s` submitted", instance, instance->file);
+
+    return instance;
+}
+
+void Loader_release(Loader_t *loader, Loader_Job_t *job)
+{
+    pthread_mutex_lock(&loader->mutex);
+    if (job->state == LOADER_JOB_STATE_RUNNING) { // Can't be stopped, will be deleted once finished.
+        job->abandoned = true;
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "job %p abandoned", job);
+    } else {
+        if (job->state == LOADER_JOB_STATE_QUEUED) {
+            _remove(loader->queued, job);
+        } else
+        if (job->state == LOADER_JOB_STATE_FINISHED) {
+            _remove(loader->finished, job);
+        } else
+        if (job->state == LOADER_JOB_STATE_COMPLETED) {
+            _remove(loader->completed, job);
+        }
+        _delete(job);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+}
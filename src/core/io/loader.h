@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <libs/fs/fs.h>
+#include <libs/gl/gl.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum _Loader_Job_Types_t {
+    LOADER_JOB_SURFACE,
+    LOADER_JOB_SHEET
+} Loader_Job_Types_t;
+
+typedef enum _Loader_Job_States_t {
+    LOADER_JOB_STATE_QUEUED,
+    LOADER_JOB_STATE_RUNNING,
+    LOADER_JOB_STATE_FINISHED, // By a worker, waiting to be handed back to the main thread.
+    LOADER_JOB_STATE_COMPLETED
+} Loader_Job_States_t;
+
+// Jobs are owned by the loader, and are handed back to the main thread (i.e. marked as completed) only at the
+// `Loader_update()` call. The result is owned by the job until it's claimed (that is, moved away).
+typedef struct _Loader_Job_t {
+    Loader_Job_Types_t type;
+    char file[FILE_PATH_MAX];
+    size_t cell_width, cell_height; // Only for sheets.
+    GL_Surface_Callback_t callback;
+    GL_Palette_t palette; // Copied at submission, as the callback user-data; workers never access the display one.
+    GL_Transparency_t transparency; // Ditto, sheets are trimmed against it.
+    void *user_data; // Available to the submitter.
+
+    Loader_Job_States_t state;
+    bool abandoned; // Released while running, to be deleted once finished.
+    bool completed; // Main thread view of the state, can be polled w/o locking.
+    bool succeeded;
+    bool claimed;
+    union {
+        GL_Surface_t surface;
+        GL_Sheet_t sheet;
+    } var;
+} Loader_Job_t;
+
+typedef struct _Loader_t {
+    const File_System_t *file_system;
+
+    pthread_t *workers;
+    size_t count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t available;
+    bool quit;
+
+    Loader_Job_t **queued; // Guarded by the mutex, along with the jobs' `state` field.
+    Loader_Job_t **finished;
+    Loader_Job_t **completed; // Handed back since last drained (by the submitter), only accessed by the main thread.
+} Loader_t;
+
+extern bool Loader_initialize(Loader_t *loader, const File_System_t *file_system, size_t workers);
+extern void Loader_terminate(Loader_t *loader);
+extern void Loader_update(Loader_t *loader);
+
+extern Loader_Job_t *Loader_submit(Loader_t *loader, const Loader_Job_t *job);
+extern void Loader_release(Loader_t *loader, Loader_Job_t *job);
+
+#endif  /* __LOADER_H__ */
@@ -25,6 +25,7 @@ local System = require("tofu.core").System
 local Input = require("tofu.events").Input
 local Canvas = require("tofu.graphics").Canvas
 local Font = require("tofu.graphics").Font
+local Loader = require("tofu.graphics").Loader
 local Class = require("tofu.util").Class
 local Timer = require("tofu.util").Timer
 
@@ -89,6 +90,7 @@ function Tofu:__ctor()
           me.main = nil
         end,
       process = function(me)
+          Loader.update()
           me.main:input()
         end,
       update = function(me, delta_time)
@@ -20,6 +20,7 @@
   SOFTWARE.
 ]]--
 
+local Loader = require("tofu.graphics").Loader
 local Class = require("tofu.util").Class
 local Timer = require("tofu.util").Timer
 
@@ -31,6 +32,7 @@ function Tofu:__ctor()
 end
 
 function Tofu:process()
+  Loader.update()
   self.main:input()
 end
 
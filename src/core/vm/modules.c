@@ -28,6 +28,7 @@
 #include <core/vm/modules/grid.h>
 #include <core/vm/modules/font.h>
 #include <core/vm/modules/input.h>
+#include <core/vm/modules/loader.h>
 #include <core/vm/modules/file.h>
 #include <core/vm/modules/math.h>
 #include <core/vm/modules/system.h>
@@ -87,6 +88,7 @@ static int graphics_loader(lua_State *L)
         { "Bank", bank_loader },
         { "Canvas", canvas_loader },
         { "Font", font_loader },
+        { "Loader", loader_loader },
         { "Surface", surface_loader },
         { NULL, NULL }
     };
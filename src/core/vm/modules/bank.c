@@ -31,19 +31,22 @@
 
 #include "udt.h"
 #include "callbacks.h"
+#include "grid.h"
 
 #include <math.h>
 #include <string.h>
 
 #define LOG_CONTEXT "bank"
 
-#define BANK_MT     "Tofu_Bank_mt"
+#define BATCH_MIN_FIELDS    3
+#define BATCH_MAX_FIELDS    6
 
 static int bank_new(lua_State *L);
 static int bank_gc(lua_State *L);
 static int bank_cell_width(lua_State *L);
 static int bank_cell_height(lua_State *L);
 static int bank_blit(lua_State *L);
+static int bank_blit_batch(lua_State *L);
 
 static const struct luaL_Reg _bank_functions[] = {
     { "new", bank_new },
@@ -51,6 +54,7 @@ static const struct luaL_Reg _bank_functions[] = {
     { "cell_width", bank_cell_width },
     { "cell_height", bank_cell_height },
     { "blit", bank_blit },
+    { "blit_batch", bank_blit_batch },
     { NULL, NULL }
 };
 
@@ -64,16 +68,18 @@ int bank_loader(lua_State *L)
     return luaX_newmodule(L, NULL, _bank_functions, _bank_constants, nup, BANK_MT);
 }
 
-static int bank_new(lua_State *L)
+static int bank_new4(lua_State *L)
 {
-    LUAX_SIGNATURE_BEGIN(L, 3)
+    LUAX_SIGNATURE_BEGIN(L, 4)
         LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING, LUA_TUSERDATA)
         LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
         LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TBOOLEAN)
     LUAX_SIGNATURE_END
     int type = lua_type(L, 1);
     size_t cell_width = (size_t)lua_tointeger(L, 2);
     size_t cell_height = (size_t)lua_tointeger(L, 3);
+    bool compiled = lua_toboolean(L, 4);
 
     const File_System_t *file_system = (const File_System_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_FILE_SYSTEM));
     const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
@@ -87,9 +93,18 @@ static int bank_new(lua_State *L)
         if (chunk.type == FILE_SYSTEM_CHUNK_NULL) {
             return luaL_error(L, "can't load file `%s`", file);
         }
-        GL_sheet_fetch(&sheet, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels }, cell_width, cell_height, surface_callback_palette, (void *)&display->palette);
+        GL_sheet_fetch(&sheet, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels, .palette = chunk.var.image.palette, .colors = chunk.var.image.colors }, cell_width, cell_height, surface_callback_palette, (void *)&display->palette);
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet `%s` loaded", file);
         FS_release(chunk);
+
+#ifdef __GL_SHEET_REPACKING__
+        if (!GL_sheet_repack(&sheet)) { // The atlas is owned, lay the cells out contiguously.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't repack sheet `%s`", file);
+        }
+#endif
+        if (!GL_sheet_trim(&sheet, &display->gl.state.transparency)) { // Immutable, trim w/ the current transparency.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't trim sheet `%s`", file);
+        }
     } else
     if (type == LUA_TUSERDATA) {
         const Surface_Class_t *instance = (const Surface_Class_t *)lua_touserdata(L, 1);
@@ -98,10 +113,15 @@ static int bank_new(lua_State *L)
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p attached", instance);
     }
 
+    if (compiled) {
+        GL_sheet_compile(&sheet, &display->gl.state.transparency); // Warm-up w/ the current transparency.
+    }
+
     Bank_Class_t *instance = (Bank_Class_t *)lua_newuserdata(L, sizeof(Bank_Class_t));
     *instance = (Bank_Class_t){
             .sheet = sheet,
-            .owned = type == LUA_TSTRING ? true : false
+            .owned = type == LUA_TSTRING ? true : false,
+            .compiled = compiled
         };
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "bank allocated as %p", instance);
 
@@ -110,6 +130,27 @@ static int bank_new(lua_State *L)
     return 1;
 }
 
+static int bank_new3(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 3)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING, LUA_TUSERDATA)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+    LUAX_SIGNATURE_END
+
+    lua_pushboolean(L, false); // Default to uncompiled sheet.
+
+    return bank_new4(L);
+}
+
+static int bank_new(lua_State *L)
+{
+    LUAX_OVERLOAD_BEGIN(L)
+        LUAX_OVERLOAD_ARITY(3, bank_new3)
+        LUAX_OVERLOAD_ARITY(4, bank_new4)
+    LUAX_OVERLOAD_END
+}
+
 static int bank_gc(lua_State *L)
 {
     LUAX_SIGNATURE_BEGIN(L, 1)
@@ -117,6 +158,9 @@ static int bank_gc(lua_State *L)
     LUAX_SIGNATURE_END
     Bank_Class_t *instance = (Bank_Class_t *)lua_touserdata(L, 1);
 
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+    GL_context_flush(&display->gl); // The atlas could be referenced by pending drawing commands.
+
     if (instance->owned) {
         GL_sheet_delete(&instance->sheet);
     } else {
@@ -151,6 +195,24 @@ static int bank_cell_height(lua_State *L)
     return 1;
 }
 
+// Unscaled blits either use the compiled runs (one set for each transparency the bank is drawn with) or, for the
+// banks owning their (immutable) atlas, the cells trimmed at load time, if the transparency still matches.
+static inline void blit_cell(const GL_Context_t *context, Bank_Class_t *instance, size_t cell_id, GL_Point_t position)
+{
+    GL_Sheet_t *sheet = &instance->sheet;
+    const GL_Sheet_Runs_t *runs = instance->compiled ? GL_sheet_compile(sheet, &context->state.transparency) : NULL;
+    const GL_Sheet_Trims_t *trims = instance->owned ? GL_sheet_trims(sheet, &context->state.transparency) : NULL;
+    if (runs) {
+        GL_context_blit_compiled(context, sheet, runs, cell_id, position);
+    } else
+    if (trims) {
+        const GL_Point_t offset = trims->offsets[cell_id];
+        GL_context_blit(context, &sheet->atlas, trims->areas[cell_id], (GL_Point_t){ .x = position.x + offset.x, .y = position.y + offset.y });
+    } else {
+        GL_context_blit(context, &sheet->atlas, sheet->cells[cell_id], position);
+    }
+}
+
 static int bank_blit4(lua_State *L)
 {
     LUAX_SIGNATURE_BEGIN(L, 4)
@@ -167,8 +229,7 @@ static int bank_blit4(lua_State *L)
     const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
 
     const GL_Context_t *context = &display->gl;
-    const GL_Sheet_t *sheet = &instance->sheet;
-    GL_context_blit(context, &sheet->atlas, sheet->cells[cell_id], (GL_Point_t){ .x = x, .y = y });
+    blit_cell(context, instance, cell_id, (GL_Point_t){ .x = x, .y = y });
 
     return 0;
 }
@@ -293,3 +354,105 @@ static int bank_blit(lua_State *L)
         LUAX_OVERLOAD_ARITY(9, bank_blit9)
     LUAX_OVERLOAD_END
 }
+
+// Each record of the batch is made up of `fields` numbers, mirroring the arguments of the `blit()` overloads
+//
+//   3 -> cell, x, y
+//   4 -> cell, x, y, rotation
+//   5 -> cell, x, y, scale_x, scale_y
+//   6 -> cell, x, y, scale_x, scale_y, rotation
+//
+// Records are drawn in order, as later cells could overlap the previous ones.
+static inline bool blit_record(const GL_Context_t *context, Bank_Class_t *instance, const float *record, size_t fields)
+{
+    const GL_Sheet_t *sheet = &instance->sheet;
+    if (!(record[0] >= 0.0f && record[0] < (float)sheet->count)) { // Also catches `NaN` values.
+        return false;
+    }
+    const size_t cell_id = (size_t)record[0];
+    const GL_Point_t position = (GL_Point_t){ .x = (int)floorf(record[1]), .y = (int)floorf(record[2]) };
+
+    if (fields == 3) {
+        blit_cell(context, instance, cell_id, position);
+    } else
+    if (fields == 4) {
+        GL_context_blit_sr(context, &sheet->atlas, sheet->cells[cell_id], position, 1.0f, 1.0f, (int)record[3], 0.5f, 0.5f);
+    } else
+    if (fields == 5) {
+        GL_context_blit_s(context, &sheet->atlas, sheet->cells[cell_id], position, record[3], record[4]);
+    } else {
+        GL_context_blit_sr(context, &sheet->atlas, sheet->cells[cell_id], position, record[3], record[4], (int)record[5], 0.5f, 0.5f);
+    }
+    return true;
+}
+
+static int bank_blit_batch3(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 3)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TTABLE, LUA_TUSERDATA)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+    LUAX_SIGNATURE_END
+    Bank_Class_t *instance = (Bank_Class_t *)lua_touserdata(L, 1);
+    int type = lua_type(L, 2);
+    size_t fields = (size_t)lua_tointeger(L, 3);
+
+    if (fields < BATCH_MIN_FIELDS || fields > BATCH_MAX_FIELDS) {
+        return luaL_error(L, "record fields %d are out of range [%d, %d]", (int)fields, BATCH_MIN_FIELDS, BATCH_MAX_FIELDS);
+    }
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    const GL_Context_t *context = &display->gl;
+
+    float record[BATCH_MAX_FIELDS];
+
+    if (type == LUA_TTABLE) { // Flat array of numbers.
+        const size_t count = lua_rawlen(L, 2) / fields;
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j = 0; j < fields; ++j) {
+                lua_rawgeti(L, 2, (lua_Integer)(i * fields + j + 1));
+                record[j] = (float)lua_tonumber(L, -1);
+                lua_pop(L, 1);
+            }
+            if (!blit_record(context, instance, record, fields)) {
+                return luaL_error(L, "record #%d cell %f is out of range [0, %d)", (int)i, (lua_Number)record[0], (int)instance->sheet.count);
+            }
+        }
+    } else
+    if (type == LUA_TUSERDATA) { // Grid, whose cells are scanned in row-major order.
+        const Grid_Class_t *grid = (const Grid_Class_t *)luaL_checkudata(L, 2, GRID_MT);
+        const Cell_t *data = grid->data;
+        const size_t count = grid->data_size / fields;
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j = 0; j < fields; ++j) {
+                record[j] = (float)*(data++);
+            }
+            if (!blit_record(context, instance, record, fields)) {
+                return luaL_error(L, "record #%d cell %f is out of range [0, %d)", (int)i, (lua_Number)record[0], (int)instance->sheet.count);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int bank_blit_batch2(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 2)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TTABLE, LUA_TUSERDATA)
+    LUAX_SIGNATURE_END
+
+    lua_pushinteger(L, BATCH_MIN_FIELDS); // Default to `(cell, x, y)` records.
+
+    return bank_blit_batch3(L);
+}
+
+static int bank_blit_batch(lua_State *L)
+{
+    LUAX_OVERLOAD_BEGIN(L)
+        LUAX_OVERLOAD_ARITY(2, bank_blit_batch2)
+        LUAX_OVERLOAD_ARITY(3, bank_blit_batch3)
+    LUAX_OVERLOAD_END
+}
@@ -25,6 +25,8 @@
 
 #include <lua/lua.h>
 
+#define BANK_MT     "Tofu_Bank_mt"
+
 extern int bank_loader(lua_State *L);
 
 #endif  /* __MODULES_BANK_H__ */
\ No newline at end of file
@@ -24,35 +24,63 @@
 
 #include <memory.h>
 
-#pragma pack(push, 1)
-typedef struct rgba_t {
-    uint8_t r, g, b, a;
-} rgba_t;
-#pragma pack(pop)
-
-void surface_callback_palette(void *user_data, GL_Surface_t *surface, const void *data)
+void surface_callback_palette(void *user_data, GL_Surface_t *surface, const GL_Image_t *image)
 {
     const GL_Palette_t *palette = (const GL_Palette_t *)user_data;
 
-    const rgba_t *src = (const rgba_t *)data;
+    if (image->colors == 0) {
+        GL_palette_find_nearest_colors(palette, surface->data, (const uint8_t *)image->data, surface->data_size);
+        return;
+    }
+
+    // Pre-indexed images only require their (small) embedded palette to be matched against the current one. When
+    // the two are the same, the indexes are copied straight away (they are all within the palette, see `FS_load()`).
+    GL_Pixel_t lut[256] = { 0 };
+    GL_palette_find_nearest_colors(palette, lut, (const uint8_t *)image->palette, image->colors);
+
+    bool identity = true;
+    for (size_t i = 0; i < image->colors; ++i) {
+        if (lut[i] != i) {
+            identity = false;
+            break;
+        }
+    }
+
+    const GL_Pixel_t *src = (const GL_Pixel_t *)image->data;
     GL_Pixel_t *dst = surface->data;
 
+    if (identity) {
+        memcpy(dst, src, surface->data_size * sizeof(GL_Pixel_t));
+        return;
+    }
+
     for (size_t i = surface->data_size; i; --i) {
-        rgba_t rgba = *(src++);
-        GL_Color_t color = (GL_Color_t){ .r = rgba.r, .g = rgba.g, .b = rgba.b, .a = rgba.a };
-        *(dst++) = GL_palette_find_nearest_color(palette, color);
+        *(dst++) = lut[*(src++)];
     }
 }
 
-void surface_callback_indexes(void *user_data, GL_Surface_t *surface, const void *data)
+void surface_callback_indexes(void *user_data, GL_Surface_t *surface, const GL_Image_t *image)
 {
     const GL_Pixel_t *indexes = (const GL_Pixel_t *)user_data;
     const GL_Pixel_t bg_index = indexes[0];
     const GL_Pixel_t fg_index = indexes[1];
 
-    const uint32_t *src = (const uint32_t *)data; // Faster than the `rgba_t` struct, we don't need to unpack components.
     GL_Pixel_t *dst = surface->data;
 
+    if (image->colors > 0) {
+        const GL_Pixel_t *src = (const GL_Pixel_t *)image->data;
+
+        const GL_Pixel_t background = *src; // The top-left pixel color defines the background.
+
+        for (size_t i = surface->data_size; i; --i) {
+            GL_Pixel_t index = *(src++);
+            *(dst++) = index == background ? bg_index : fg_index;
+        }
+        return;
+    }
+
+    const uint32_t *src = (const uint32_t *)image->data; // Compared as a whole, no need to unpack the components.
+
     const uint32_t background = *src; // The top-left pixel color defines the background.
 
     for (size_t i = surface->data_size; i; --i) {
@@ -25,7 +25,7 @@
 
 #include <libs/gl/gl.h>
 
-extern void surface_callback_palette(void *user_data, GL_Surface_t *surface, const void *data);
-extern void surface_callback_indexes(void *user_data, GL_Surface_t *surface, const void *data);
+extern void surface_callback_palette(void *user_data, GL_Surface_t *surface, const GL_Image_t *image);
+extern void surface_callback_indexes(void *user_data, GL_Surface_t *surface, const GL_Image_t *image);
 
 #endif  /* __MODULES_CALLBACKS_H__ */
\ No newline at end of file
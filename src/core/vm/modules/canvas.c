@@ -68,6 +68,7 @@ static int canvas_line(lua_State *L);
 static int canvas_polyline(lua_State *L);
 static int canvas_fill(lua_State *L);
 static int canvas_triangle(lua_State *L);
+static int canvas_triangles(lua_State *L);
 static int canvas_rectangle(lua_State *L);
 static int canvas_circle(lua_State *L);
 static int canvas_peek(lua_State *L);
@@ -105,6 +106,7 @@ static const struct luaL_Reg _canvas_functions[] = {
     { "polyline", canvas_polyline },
     { "fill", canvas_fill },
     { "triangle", canvas_triangle },
+    { "triangles", canvas_triangles },
     { "rectangle", canvas_rectangle },
     { "circle", canvas_circle },
     { "peek", canvas_peek },
@@ -183,7 +185,9 @@ static int canvas_push(lua_State *L)
     Display_t *display = (Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
 
     GL_Context_t *context = &display->gl;
-    GL_context_push(context);
+    if (!GL_context_push(context)) {
+        return luaL_error(L, "can't push state, stack is full (%d entries)", GL_CONTEXT_STACK_CAPACITY);
+    }
 
     return 0;
 }
@@ -890,6 +894,50 @@ static int canvas_triangle(lua_State *L)
     return 0;
 }
 
+static int canvas_triangles(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 2)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TTABLE)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+    LUAX_SIGNATURE_END
+    GL_Pixel_t index = (GL_Pixel_t)lua_tointeger(L, 2);
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    index %= display->palette.count;
+
+    GL_Point_t *vertices = NULL;
+    size_t count = 0;
+    int aux = 0;
+
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        int value = lua_tointeger(L, -1);
+        ++count;
+        if ((count % 2) == 0) {
+            GL_Point_t point = (GL_Point_t){ .x = aux, .y = value }; // Can't pass compound-literal to macro. :(
+            arrpush(vertices, point);
+        } else {
+            aux = value;
+        }
+        lua_pop(L, 1);
+    }
+
+    if ((count % 6) != 0) { // Three points, i.e. six coordinates, for each triangle.
+        arrfree(vertices);
+        return luaL_error(L, "triangles coordinates count %d is not a multiple of 6", (int)count);
+    }
+
+    if (count > 0) {
+        const GL_Context_t *context = &display->gl;
+        GL_primitive_triangles(context, vertices, count / 2, index);
+    }
+
+    arrfree(vertices);
+
+    return 0;
+}
+
 static int canvas_rectangle(lua_State *L)
 {
     LUAX_SIGNATURE_BEGIN(L, 6)
@@ -985,6 +1033,8 @@ static int canvas_peek(lua_State *L)
     const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
 
     const GL_Context_t *context = &display->gl;
+    GL_context_flush(context);
+
     const GL_Surface_t *surface = context->state.surface;
     GL_Pixel_t index = surface->data[y * surface->width + x];
 
@@ -1009,8 +1059,11 @@ static int canvas_poke(lua_State *L)
     index %= display->palette.count;
 
     const GL_Context_t *context = &display->gl;
+    GL_context_flush(context);
+
     GL_Surface_t *surface = context->state.surface;
     surface->data[y * surface->width + x] = index;
+    GL_context_dirty(context, &(GL_Quad_t){ .x0 = x, .y0 = y, .x1 = x, .y1 = y });
 
     return 0;
 }
@@ -129,10 +129,18 @@ static int font_new3(lua_State *L)
             if (chunk.type == FILE_SYSTEM_CHUNK_NULL) {
                 return luaL_error(L, "can't load file `%s`", file);
             }
-            GL_sheet_fetch(&sheet, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels }, glyph_width, glyph_height, surface_callback_palette, (void *)&display->palette);
+            GL_sheet_fetch(&sheet, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels, .palette = chunk.var.image.palette, .colors = chunk.var.image.colors }, glyph_width, glyph_height, surface_callback_palette, (void *)&display->palette);
             Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet `%s` loaded", file);
             FS_release(chunk);
         }
+#ifdef __GL_SHEET_REPACKING__
+        if (!GL_sheet_repack(&sheet)) { // The atlas is owned, lay the glyphs out contiguously.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't repack sheet `%s`", file);
+        }
+#endif
+        if (!GL_sheet_trim(&sheet, &display->gl.state.transparency)) { // Immutable, trim w/ the current transparency.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't trim sheet `%s`", file);
+        }
     } else
     if (type == LUA_TUSERDATA) {
         const Surface_Class_t *instance = (const Surface_Class_t *)lua_touserdata(L, 1);
@@ -169,6 +177,7 @@ static int font_new5(lua_State *L)
     GL_Pixel_t foreground_index = (GL_Pixel_t)lua_tointeger(L, 5);
 
     const File_System_t *file_system = (const File_System_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_FILE_SYSTEM));
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
 
     GL_Sheet_t sheet;
     luaX_Reference surface = LUAX_REFERENCE_NIL;
@@ -187,10 +196,18 @@ static int font_new5(lua_State *L)
             if (chunk.type == FILE_SYSTEM_CHUNK_NULL) {
                 return luaL_error(L, "can't load file `%s`", file);
             }
-            GL_sheet_fetch(&sheet, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels }, glyph_width, glyph_height, surface_callback_palette, (void *)indexes);
+            GL_sheet_fetch(&sheet, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels, .palette = chunk.var.image.palette, .colors = chunk.var.image.colors }, glyph_width, glyph_height, surface_callback_indexes, (void *)indexes);
             Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet `%s` loaded", file);
             FS_release(chunk);
         }
+#ifdef __GL_SHEET_REPACKING__
+        if (!GL_sheet_repack(&sheet)) { // The atlas is owned, lay the glyphs out contiguously.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't repack sheet `%s`", file);
+        }
+#endif
+        if (!GL_sheet_trim(&sheet, &display->gl.state.transparency)) { // Immutable, trim w/ the current transparency.
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't trim sheet `%s`", file);
+        }
     } else
     if (type == LUA_TUSERDATA) {
         const Surface_Class_t *instance = (const Surface_Class_t *)lua_touserdata(L, 1);
@@ -226,6 +243,9 @@ static int font_gc(lua_State *L)
     LUAX_SIGNATURE_END
     Font_Class_t *instance = (Font_Class_t *)lua_touserdata(L, 1);
 
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+    GL_context_flush(&display->gl); // The atlas could be referenced by pending drawing commands.
+
     if (instance->surface == LUAX_REFERENCE_NIL) {
         GL_sheet_delete(&instance->sheet);
     } else {
@@ -281,6 +301,14 @@ static int font_write5(lua_State *L)
     const GL_Context_t *context = &display->gl;
     const GL_Sheet_t *sheet = &instance->sheet;
 
+    const GL_Rectangle_t *areas = sheet->cells;
+    const GL_Point_t *offsets = NULL;
+    const GL_Sheet_Trims_t *trims = GL_sheet_trims(sheet, &context->state.transparency); // Only for owned atlases.
+    if (trims) {
+        areas = trims->areas;
+        offsets = trims->offsets;
+    }
+
     int dw = sheet->size.width;
     int dh = sheet->size.height;
 
@@ -299,7 +327,12 @@ static int font_write5(lua_State *L)
         if (*ptr < ' ') {
             continue;
         }
-        GL_context_blit(context, &sheet->atlas, sheet->cells[*ptr - ' '], (GL_Point_t){ .x = dx, .y = dy });
+        const int glyph = *ptr - ' ';
+        if (offsets) {
+            GL_context_blit(context, &sheet->atlas, areas[glyph], (GL_Point_t){ .x = dx + offsets[glyph].x, .y = dy + offsets[glyph].y });
+        } else {
+            GL_context_blit(context, &sheet->atlas, areas[glyph], (GL_Point_t){ .x = dx, .y = dy });
+        }
         dx += dw;
     }
 
@@ -34,8 +34,6 @@
 
 #define LOG_CONTEXT "grid"
 
-#define GRID_MT        "Tofu_Grid_mt"
-
 static int grid_new(lua_State *L);
 static int grid_gc(lua_State *L);
 static int grid_width(lua_State *L);
@@ -25,6 +25,8 @@
 
 #include <lua/lua.h>
 
+#define GRID_MT        "Tofu_Grid_mt"
+
 extern int grid_loader(lua_State *L);
 
 #endif  /* __MODULES_GRID_H__ */
\ No newline at end of file
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#include "loader.h"
+
+#include <config.h>
+#include <core/io/display.h>
+#include <core/io/loader.h>
+#include <core/vm/interpreter.h>
+#include <libs/log.h>
+#include <libs/stb.h>
+
+#include "udt.h"
+#include "bank.h"
+#include "callbacks.h"
+#include "surface.h"
+
+#include <string.h>
+
+#define LOG_CONTEXT "loader"
+
+#define LOADER_MT       "Tofu_Loader_mt"
+
+static int loader_surface(lua_State *L);
+static int loader_bank(lua_State *L);
+static int loader_update(lua_State *L);
+static int loader_gc(lua_State *L);
+static int loader_ready(lua_State *L);
+static int loader_get(lua_State *L);
+
+static const struct luaL_Reg _loader_functions[] = {
+    { "surface", loader_surface },
+    { "bank", loader_bank },
+    { "update", loader_update },
+    {"__gc", loader_gc },
+    { "ready", loader_ready },
+    { "get", loader_get },
+    { NULL, NULL }
+};
+
+static const luaX_Const _loader_constants[] = {
+    { NULL }
+};
+
+int loader_loader(lua_State *L)
+{
+    int nup = luaX_pushupvalues(L);
+    return luaX_newmodule(L, NULL, _loader_functions, _loader_constants, nup, LOADER_MT);
+}
+
+// The handle is created prior submitting the job, as it's tracked by the job itself (when a callback is given) in
+// order to be notified upon completion.
+static int _submit(lua_State *L, const Loader_Job_t *job, bool compiled, int callback)
+{
+    Loader_t *loader = (Loader_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_LOADER));
+
+    Loader_Class_t *instance = (Loader_Class_t *)lua_newuserdata(L, sizeof(Loader_Class_t));
+    *instance = (Loader_Class_t){
+            .job = NULL,
+            .compiled = compiled,
+            .callback = LUAX_REFERENCE_NIL,
+            .self = LUAX_REFERENCE_NIL,
+            .object = LUAX_REFERENCE_NIL
+        };
+    luaL_setmetatable(L, LOADER_MT);
+
+    Loader_Job_t template = *job;
+    if (!lua_isnil(L, callback)) {
+        instance->callback = luaX_ref(L, callback);
+        instance->self = luaX_ref(L, -1);
+        template.user_data = instance;
+    }
+
+    instance->job = Loader_submit(loader, &template);
+    if (!instance->job) {
+        if (instance->self != LUAX_REFERENCE_NIL) { // Let it be collected.
+            luaX_unref(L, instance->self);
+            instance->self = LUAX_REFERENCE_NIL;
+        }
+        return luaL_error(L, "can't submit file `%s`", job->file);
+    }
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "loader %p allocated for job %p", instance, instance->job);
+
+    return 1;
+}
+
+static int loader_surface2(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 2)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TFUNCTION, LUA_TNIL)
+    LUAX_SIGNATURE_END
+    const char *file = lua_tostring(L, 1);
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    Loader_Job_t job = (Loader_Job_t){
+            .type = LOADER_JOB_SURFACE,
+            .callback = surface_callback_palette,
+            .palette = display->palette
+        };
+    strncpy(job.file, file, FILE_PATH_MAX - 1);
+
+    return _submit(L, &job, false, 2);
+}
+
+static int loader_surface1(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 1)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING)
+    LUAX_SIGNATURE_END
+
+    lua_pushnil(L); // No callback, the handle will be polled.
+
+    return loader_surface2(L);
+}
+
+static int loader_surface(lua_State *L)
+{
+    LUAX_OVERLOAD_BEGIN(L)
+        LUAX_OVERLOAD_ARITY(1, loader_surface1) // file
+        LUAX_OVERLOAD_ARITY(2, loader_surface2) // file, callback
+    LUAX_OVERLOAD_END
+}
+
+static int loader_bank5(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 5)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TBOOLEAN)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TFUNCTION, LUA_TNIL)
+    LUAX_SIGNATURE_END
+    const char *file = lua_tostring(L, 1);
+    size_t cell_width = (size_t)lua_tointeger(L, 2);
+    size_t cell_height = (size_t)lua_tointeger(L, 3);
+    bool compiled = lua_toboolean(L, 4);
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    Loader_Job_t job = (Loader_Job_t){
+            .type = LOADER_JOB_SHEET,
+            .cell_width = cell_width,
+            .cell_height = cell_height,
+            .callback = surface_callback_palette,
+            .palette = display->palette,
+            .transparency = display->gl.state.transparency
+        };
+    strncpy(job.file, file, FILE_PATH_MAX - 1);
+
+    return _submit(L, &job, compiled, 5);
+}
+
+static int loader_bank4(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 4)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TBOOLEAN)
+    LUAX_SIGNATURE_END
+
+    lua_pushnil(L); // No callback, the handle will be polled.
+
+    return loader_bank5(L);
+}
+
+static int loader_bank3(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 3)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TSTRING)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+    LUAX_SIGNATURE_END
+
+    lua_pushboolean(L, false); // Default to uncompiled sheet.
+
+    return loader_bank4(L);
+}
+
+static int loader_bank(lua_State *L)
+{
+    LUAX_OVERLOAD_BEGIN(L)
+        LUAX_OVERLOAD_ARITY(3, loader_bank3) // file, cell_width, cell_height
+        LUAX_OVERLOAD_ARITY(4, loader_bank4) // file, cell_width, cell_height, compiled
+        LUAX_OVERLOAD_ARITY(5, loader_bank5) // file, cell_width, cell_height, compiled, callback
+    LUAX_OVERLOAD_END
+}
+
+// Pushes the object created from the job result (the same one, on later calls) or `nil` when the job failed.
+static void _claim(lua_State *L, Loader_Class_t *instance, const Display_t *display)
+{
+    if (instance->object != LUAX_REFERENCE_NIL) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, instance->object);
+        return;
+    }
+
+    Loader_Job_t *job = instance->job;
+    if (!job->succeeded) {
+        lua_pushnil(L);
+        return;
+    }
+
+    if (job->type == LOADER_JOB_SURFACE) {
+        Surface_Class_t *surface = (Surface_Class_t *)lua_newuserdata(L, sizeof(Surface_Class_t));
+        *surface = (Surface_Class_t){
+                .surface = job->var.surface,
+                .xform = (GL_XForm_t){
+                        .registers = {
+                            0.0f, 0.0f, // No offset
+                            1.0f, 0.0f, 1.0f, 0.0f, // Identity matrix.
+                            0.0f, 0.0f, // No offset
+                        },
+                        .clamp = GL_XFORM_CLAMP_REPEAT,
+                        .table = NULL
+                    }
+            };
+        luaL_setmetatable(L, SURFACE_MT);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "surface `%s` claimed as %p", job->file, surface);
+    } else
+    if (job->type == LOADER_JOB_SHEET) {
+        if (instance->compiled) { // Depends on the current drawing state, can't be done in background.
+            GL_sheet_compile(&job->var.sheet, &display->gl.state.transparency);
+        }
+
+        Bank_Class_t *bank = (Bank_Class_t *)lua_newuserdata(L, sizeof(Bank_Class_t));
+        *bank = (Bank_Class_t){
+                .sheet = job->var.sheet,
+                .owned = true,
+                .compiled = instance->compiled
+            };
+        luaL_setmetatable(L, BANK_MT);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "bank `%s` claimed as %p", job->file, bank);
+    }
+    job->claimed = true;
+
+    instance->object = luaX_ref(L, -1);
+}
+
+// Called once per frame, notifies the jobs handed back by the engine. Callbacks are passed the object (or `nil` and
+// an error message, on failure) and could well release other handles, so the jobs are consumed one at a time.
+static int loader_update(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 0)
+    LUAX_SIGNATURE_END
+
+    const Interpreter_t *interpreter = (const Interpreter_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_INTERPRETER));
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+    Loader_t *loader = (Loader_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_LOADER));
+
+    while (arrlen(loader->completed) > 0) {
+        Loader_Job_t *job = loader->completed[0];
+        arrdel(loader->completed, 0);
+
+        Loader_Class_t *instance = (Loader_Class_t *)job->user_data;
+        if (!instance) { // No callback, will be polled.
+            continue;
+        }
+        job->user_data = NULL;
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, instance->self); // Keep the handle alive during the call, then unanchor it.
+        luaX_unref(L, instance->self);
+        instance->self = LUAX_REFERENCE_NIL;
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, instance->callback);
+        luaX_unref(L, instance->callback);
+        instance->callback = LUAX_REFERENCE_NIL;
+
+        _claim(L, instance, display);
+        if (job->succeeded) {
+            Interpreter_call(interpreter, 1, 0);
+        } else {
+            lua_pushfstring(L, "can't load file `%s`", job->file);
+            Interpreter_call(interpreter, 2, 0);
+        }
+        lua_pop(L, 1);
+    }
+
+    return 0;
+}
+
+static int loader_gc(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 1)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+    LUAX_SIGNATURE_END
+    Loader_Class_t *instance = (Loader_Class_t *)lua_touserdata(L, 1);
+
+    Loader_t *loader = (Loader_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_LOADER));
+
+    if (instance->object != LUAX_REFERENCE_NIL) {
+        luaX_unref(L, instance->object);
+    }
+    if (instance->callback != LUAX_REFERENCE_NIL) {
+        luaX_unref(L, instance->callback);
+    }
+    if (instance->self != LUAX_REFERENCE_NIL) {
+        luaX_unref(L, instance->self);
+    }
+
+    if (instance->job) {
+        Loader_release(loader, instance->job); // The result is deleted, unless claimed.
+    }
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "loader %p finalized", instance);
+
+    return 0;
+}
+
+static int loader_ready(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 1)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+    LUAX_SIGNATURE_END
+    const Loader_Class_t *instance = (const Loader_Class_t *)lua_touserdata(L, 1);
+
+    lua_pushboolean(L, instance->job->completed);
+
+    return 1;
+}
+
+static int loader_get(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 1)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+    LUAX_SIGNATURE_END
+    Loader_Class_t *instance = (Loader_Class_t *)lua_touserdata(L, 1);
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    const Loader_Job_t *job = instance->job;
+    if (!job->completed) {
+        return luaL_error(L, "file `%s` is still loading", job->file);
+    }
+    if (!job->succeeded) {
+        return luaL_error(L, "can't load file `%s`", job->file);
+    }
+
+    _claim(L, instance, display);
+
+    return 1;
+}
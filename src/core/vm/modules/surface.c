@@ -36,14 +36,13 @@
 
 #define LOG_CONTEXT "surface"
 
-#define SURFACE_MT      "Tofu_Surface_mt"
-
 static int surface_new(lua_State *L);
 static int surface_gc(lua_State *L);
 static int surface_width(lua_State *L);
 static int surface_height(lua_State *L);
 static int surface_grab(lua_State *L);
 static int surface_blit(lua_State *L);
+static int surface_mesh(lua_State *L);
 static int surface_xform(lua_State *L);
 static int surface_offset(lua_State *L);
 static int surface_matrix(lua_State *L);
@@ -57,6 +56,7 @@ static const struct luaL_Reg _surface_functions[] = {
     { "height", surface_height },
     { "grab", surface_grab },
     { "blit", surface_blit },
+    { "mesh", surface_mesh },
     { "xform", surface_xform },
     { "offset", surface_offset },
     { "matrix", surface_matrix },
@@ -120,7 +120,7 @@ static int surface_new1(lua_State *L)
         return luaL_error(L, "can't load file `%s`", file);
     }
     GL_Surface_t surface;
-    GL_surface_fetch(&surface, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels }, surface_callback_palette, (void *)&display->palette);
+    GL_surface_fetch(&surface, (GL_Image_t){ .width = chunk.var.image.width, .height = chunk.var.image.height, .data = chunk.var.image.pixels, .palette = chunk.var.image.palette, .colors = chunk.var.image.colors }, surface_callback_palette, (void *)&display->palette);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "surface `%s` loaded", file);
     FS_release(chunk);
 
@@ -199,8 +199,8 @@ static int surface_gc(lua_State *L)
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "surface %p sanitized from context", instance);
 
     if (instance->xform.table) {
-        arrfree(instance->xform.table);
-        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "scan-line table %p deallocated", instance->xform.table);
+        GL_xform_table_clear(&instance->xform);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "scan-line table deallocated");
     }
 
     GL_surface_delete(&instance->surface);
@@ -472,6 +472,49 @@ static int surface_blit(lua_State *L)
     LUAX_OVERLOAD_END
 }
 
+// The vertices are a flat array of numbers, four for each vertex (i.e. `x, y, u, v`, with the texture coordinates
+// in surface pixels) and three vertices for each triangle. The whole mesh is drawn with a single call.
+static int surface_mesh(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 2)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TTABLE)
+    LUAX_SIGNATURE_END
+    Surface_Class_t *instance = (Surface_Class_t *)lua_touserdata(L, 1);
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    const size_t length = lua_rawlen(L, 2);
+    if ((length % 4) != 0) { // Four values, i.e. `x, y, u, v`, for each vertex.
+        return luaL_error(L, "mesh values count %d is not a multiple of 4", (int)length);
+    }
+    const size_t count = length / 4;
+    if (count == 0 || (count % 3) != 0) { // Three vertices for each triangle.
+        return luaL_error(L, "mesh vertices count %d is not a positive multiple of 3", (int)count);
+    }
+
+    GL_Vertex_t *vertices = NULL;
+    arrsetcap(vertices, count);
+
+    for (size_t i = 0; i < count; ++i) {
+        float values[4];
+        for (size_t j = 0; j < 4; ++j) {
+            lua_rawgeti(L, 2, (lua_Integer)(i * 4 + j + 1));
+            values[j] = (float)lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        }
+        GL_Vertex_t vertex = (GL_Vertex_t){ .x = (int)floorf(values[0]), .y = (int)floorf(values[1]), .u = values[2], .v = values[3] };
+        arrpush(vertices, vertex);
+    }
+
+    const GL_Context_t *context = &display->gl;
+    GL_primitive_textured_triangles(context, &instance->surface, vertices, count);
+
+    arrfree(vertices);
+
+    return 0;
+}
+
 static int surface_xform1(lua_State *L)
 {
     LUAX_SIGNATURE_BEGIN(L, 1)
@@ -641,10 +684,9 @@ static int surface_table1(lua_State *L)
     Surface_Class_t *instance = (Surface_Class_t *)lua_touserdata(L, 1);
 
     if (instance->xform.table) {
-        arrfree(instance->xform.table);
-        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "scan-line table %p deallocated", instance->xform.table);
+        GL_xform_table_clear(&instance->xform);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "scan-line table deallocated");
     }
-    instance->xform.table = NULL;
 
     return 0;
 }
@@ -683,13 +725,41 @@ static int surface_table2(lua_State *L)
 
         lua_pop(L, 1);
     }
-    arrpush(table, (GL_XForm_Table_Entry_t){ .scan_line = -1 }); // Set the end-of-data (safety) marker
 
-    if (instance->xform.table) {
-        arrfree(instance->xform.table);
-//        Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "scan-line table %p reallocated as %p", instance->xform.table, table);
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    // The entries are compiled into a per-scan-line table, and are no longer needed. As for the perspective table,
+    // the scan-lines are bound by the canvas height.
+    const GL_Context_t *context = &display->gl;
+    bool compiled = GL_xform_table_compile(&instance->xform, table, arrlen(table), context->buffer.height);
+    arrfree(table);
+    if (!compiled) {
+        return luaL_error(L, "can't compile scan-line table");
+    }
+
+    return 0;
+}
+
+// Generates a floor perspective table, with the view-point rotated by `angle` at `elevation` from the floor, for
+// each of the canvas scan-lines.
+static int surface_table3(lua_State *L)
+{
+    LUAX_SIGNATURE_BEGIN(L, 3)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TUSERDATA)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+        LUAX_SIGNATURE_ARGUMENT(LUA_TNUMBER)
+    LUAX_SIGNATURE_END
+    Surface_Class_t *instance = (Surface_Class_t *)lua_touserdata(L, 1);
+    float angle = (float)lua_tonumber(L, 2);
+    float elevation = (float)lua_tonumber(L, 3);
+
+    const Display_t *display = (const Display_t *)lua_touserdata(L, lua_upvalueindex(USERDATA_DISPLAY));
+
+    const GL_Context_t *context = &display->gl;
+    // Sized on the canvas, as the current target could well be an off-screen surface at the time of the call.
+    if (!GL_xform_table_perspective(&instance->xform, context->buffer.height, angle, elevation)) {
+        return luaL_error(L, "can't generate scan-line table");
     }
-    instance->xform.table = table;
 
     return 0;
 }
@@ -699,5 +769,6 @@ static int surface_table(lua_State *L)
     LUAX_OVERLOAD_BEGIN(L)
         LUAX_OVERLOAD_ARITY(1, surface_table1)
         LUAX_OVERLOAD_ARITY(2, surface_table2)
+        LUAX_OVERLOAD_ARITY(3, surface_table3)
     LUAX_OVERLOAD_END
 }
@@ -25,6 +25,8 @@
 
 #include <lua/lua.h>
 
+#define SURFACE_MT      "Tofu_Surface_mt"
+
 extern int surface_loader(lua_State *L);
 
 #endif  /* __MODULES_SURFACE_H__ */
\ No newline at end of file
@@ -23,6 +23,7 @@
 #ifndef __MODULES_UDT_H__
 #define __MODULES_UDT_H__
 
+#include <core/io/loader.h>
 #include <libs/luax.h>
 #include <libs/gl/gl.h>
 
@@ -31,7 +32,8 @@ typedef enum _UserData_t { // TODO: move to a suitable space.
     USERDATA_FILE_SYSTEM,
     USERDATA_ENVIRONMENT,
     USERDATA_DISPLAY,
-    USERDATA_INPUT
+    USERDATA_INPUT,
+    USERDATA_LOADER
 } UserData_t;
 
 typedef struct _Bank_Class_t {
@@ -39,6 +41,7 @@ typedef struct _Bank_Class_t {
     // char full_path[PATH_FILE_MAX];
     GL_Sheet_t sheet;
     bool owned;
+    bool compiled;
 } Bank_Class_t;
 
 typedef struct _Canvas_Class_t {
@@ -75,6 +78,15 @@ typedef struct _Input_Class_t {
     const void *bogus;
 } Input_Class_t;
 
+typedef struct _Loader_Class_t {
+    const void *bogus;
+    Loader_Job_t *job;
+    bool compiled; // Only for banks, compiled once claimed on the main thread.
+    luaX_Reference callback;
+    luaX_Reference self; // Anchors the handle until the callback is called, even if no longer referenced.
+    luaX_Reference object; // Created from the job result at the first request, then reused.
+} Loader_Class_t;
+
 typedef struct _Math_Class_t {
     const void *bogus;
 } Math_Class_t;
@@ -28,13 +28,32 @@
 #include <libs/log.h>
 #include <libs/stb.h>
 
+#include <ctype.h>
 #include <dirent.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #define LOG_CONTEXT "fs"
 
+#define IMAGE_SIGNATURE         "TOFUIMG!"
+#define IMAGE_SIGNATURE_LENGTH  8
+
+#define IMAGE_VERSION           0
+
+#pragma pack(push, 1)
+typedef struct _Image_Header_t {
+    char signature[IMAGE_SIGNATURE_LENGTH];
+    uint8_t version;
+    uint8_t __reserved;
+    uint16_t colors; // The header is followed by `colors` RGBA palette entries and `width * height` indexes.
+    uint32_t width;
+    uint32_t height;
+} Image_Header_t;
+#pragma pack(pop)
+
 const File_System_Callbacks_t *_detect(const char *path)
 {
     struct stat path_stat;
@@ -54,6 +73,87 @@ const File_System_Callbacks_t *_detect(const char *path)
     return NULL;
 }
 
+// Paths are indexed case-insensitively (as archives always did), w/ both separators, and w/ `.` and `..` resolved.
+// Paths escaping the root are rejected.
+static bool _normalize(const char *file, char *key)
+{
+    size_t length = 0;
+    for (const char *ptr = file; *ptr != '\0'; ) {
+        const char *start = ptr;
+        while (*ptr != '\0' && *ptr != '/' && *ptr != '\\') {
+            ++ptr;
+        }
+        size_t component = ptr - start;
+        if (*ptr != '\0') {
+            ++ptr;
+        }
+
+        if (component == 0 || (component == 1 && start[0] == '.')) {
+            continue;
+        } else
+        if (component == 2 && start[0] == '.' && start[1] == '.') {
+            if (length == 0) {
+                return false;
+            }
+            while (length > 0 && key[length - 1] != FILE_SYSTEM_PATH_SEPARATOR) { // Drop last component...
+                --length;
+            }
+            if (length > 0) { // ... and its separator.
+                --length;
+            }
+            continue;
+        }
+
+        if (length + component + 2 > FILE_PATH_MAX) {
+            return false;
+        }
+        if (length > 0) {
+            key[length++] = FILE_SYSTEM_PATH_SEPARATOR;
+        }
+        for (size_t i = 0; i < component; ++i) {
+            key[length++] = (char)tolower((unsigned char)start[i]);
+        }
+    }
+    key[length] = '\0';
+    return length > 0;
+}
+
+typedef struct _Index_Context_t {
+    File_System_t *file_system;
+    size_t mount_point;
+} Index_Context_t;
+
+static void _index(void *user_data, const char *file, const void *entry)
+{
+    const Index_Context_t *context = (const Index_Context_t *)user_data;
+    File_System_t *file_system = context->file_system;
+
+    char key[FILE_PATH_MAX];
+    if (!_normalize(file, key)) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't index file `%s`", file);
+        return;
+    }
+
+    ptrdiff_t index = shgeti(file_system->index, key);
+    if (index != -1) { // Overridden by a later mount-point.
+        free(file_system->index[index].value.file);
+    }
+    size_t length = strlen(file);
+    char *copy = malloc((length + 1) * sizeof(char));
+    if (!copy) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate index entry for file `%s`", file);
+        return;
+    }
+    memcpy(copy, file, length + 1);
+
+    File_System_Index_Entry_t value = (File_System_Index_Entry_t){
+            .mount_point = context->mount_point,
+            .file = copy,
+            .entry = entry
+        };
+    shput(file_system->index, key, value);
+}
+
 static bool _mount(File_System_t *file_system, const char *base_path)
 {
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "adding mount-point `%s`", base_path);
@@ -76,14 +176,16 @@ static bool _mount(File_System_t *file_system, const char *base_path)
         };
     arrpush(file_system->mount_points, mount_point);
 
+    callbacks->scan(context, _index, &(Index_Context_t){ .file_system = file_system, .mount_point = arrlen(file_system->mount_points) - 1 });
+
     return true;
 }
 
 // FIXME: convert bool argument to flags.
-static void *_load(const File_System_Callbacks_t *callbacks, const void *context, const char *file, bool null_terminate, size_t *size)
+static void *_load(const File_System_Callbacks_t *callbacks, const void *context, const char *file, const void *entry, bool null_terminate, size_t *size)
 {
     size_t bytes_to_read;
-    void *handle = callbacks->open(context, file, &bytes_to_read);
+    void *handle = callbacks->open(context, file, entry, &bytes_to_read);
     if (!handle) {
         return NULL;
     }
@@ -108,10 +210,10 @@ static void *_load(const File_System_Callbacks_t *callbacks, const void *context
     return data;
 }
 
-static File_System_Chunk_t load_as_string(const File_System_Callbacks_t *callbacks, const void *context, const char *file)
+static File_System_Chunk_t load_as_string(const File_System_Callbacks_t *callbacks, const void *context, const char *file, const void *entry)
 {
     size_t length;
-    void *chars = _load(callbacks, context, file, true, &length);
+    void *chars = _load(callbacks, context, file, entry, true, &length);
     if (!chars) {
         return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
     }
@@ -126,10 +228,10 @@ static File_System_Chunk_t load_as_string(const File_System_Callbacks_t *callbac
         };
 }
 
-static File_System_Chunk_t load_as_binary(const File_System_Callbacks_t *callbacks, const void *context, const char *file)
+static File_System_Chunk_t load_as_binary(const File_System_Callbacks_t *callbacks, const void *context, const char *file, const void *entry)
 {
     size_t size;
-    void *ptr = _load(callbacks, context, file, false, &size);
+    void *ptr = _load(callbacks, context, file, entry, false, &size);
     if (!ptr) {
         return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
     }
@@ -144,27 +246,38 @@ static File_System_Chunk_t load_as_binary(const File_System_Callbacks_t *callbac
         };
 }
 
+// The bytes already read from the handle (e.g. when probing for a signature) are served first, as a prefix, so
+// that the handle needs not to be rewound.
 typedef struct _stbi_context_t {
     const File_System_Callbacks_t *callbacks;
     void *handle;
+    const uint8_t *prefix;
+    size_t prefix_size;
 } stbi_context_t;
 
 static int stb_stdio_read(void *user, char *data, int size)
 {
-    const stbi_context_t *stbi_context = (const stbi_context_t *)user;
-    return (int)stbi_context->callbacks->read(stbi_context->handle, data, (size_t)size);
+    stbi_context_t *stbi_context = (stbi_context_t *)user;
+    size_t length = stbi_context->prefix_size < (size_t)size ? stbi_context->prefix_size : (size_t)size;
+    memcpy(data, stbi_context->prefix, length);
+    stbi_context->prefix += length;
+    stbi_context->prefix_size -= length;
+    return (int)(length + stbi_context->callbacks->read(stbi_context->handle, data + length, (size_t)size - length));
 }
 
 static void stb_stdio_skip(void *user, int n)
 {
-    const stbi_context_t *stbi_context = (const stbi_context_t *)user;
-    stbi_context->callbacks->skip(stbi_context->handle, n);
+    stbi_context_t *stbi_context = (stbi_context_t *)user;
+    size_t length = stbi_context->prefix_size < (size_t)n ? stbi_context->prefix_size : (size_t)n;
+    stbi_context->prefix += length;
+    stbi_context->prefix_size -= length;
+    stbi_context->callbacks->skip(stbi_context->handle, n - (int)length);
 }
 
 static int stb_stdio_eof(void *user)
 {
     const stbi_context_t *stbi_context = (const stbi_context_t *)user;
-    return stbi_context->callbacks->eof(stbi_context->handle) ? -1 : 0;
+    return stbi_context->prefix_size == 0 && stbi_context->callbacks->eof(stbi_context->handle) ? -1 : 0;
 }
 
 static const stbi_io_callbacks _io_callbacks = {
@@ -173,23 +286,102 @@ static const stbi_io_callbacks _io_callbacks = {
     stb_stdio_eof,
 };
 
-static File_System_Chunk_t load_as_image(const File_System_Callbacks_t *callbacks, const void *context, const char *file)
+// The header comes from the file, and is checked against the actual file size (which is `size` bytes, header
+// included) paying attention not to overflow, as `size_t` could well be 32 bits wide.
+static bool is_valid_header(const Image_Header_t *header, size_t size, size_t *palette_size, size_t *pixels_size)
+{
+    if (header->version != IMAGE_VERSION || header->colors == 0 || header->colors > 256
+        || header->width == 0 || header->height == 0 || header->width > SIZE_MAX / header->height) {
+        return false;
+    }
+    *palette_size = (size_t)header->colors * 4;
+    *pixels_size = (size_t)header->width * (size_t)header->height;
+    return size >= sizeof(Image_Header_t) && *palette_size <= size - sizeof(Image_Header_t)
+        && *pixels_size <= size - sizeof(Image_Header_t) - *palette_size;
+}
+
+// Indexes beyond the palette are rejected once for all, so that the surface callbacks need not check them.
+static bool are_valid_indexes(const uint8_t *pixels, size_t size, size_t colors)
+{
+    if (colors > UINT8_MAX) { // Every index fits.
+        return true;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        if (pixels[i] >= colors) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static File_System_Chunk_t load_as_indexed(const File_System_Callbacks_t *callbacks, void *handle, size_t size, const Image_Header_t *header, const char *file)
+{
+    size_t palette_size, pixels_size;
+    if (!is_valid_header(header, size, &palette_size, &pixels_size)) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "file `%s` is not a valid indexed image", file);
+        return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    }
+
+    uint8_t *data = malloc(palette_size + pixels_size); // Single allocation, the palette comes first.
+    if (!data) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate %d bytes for indexed image `%s`", palette_size + pixels_size, file);
+        return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    }
+
+    size_t bytes_read = callbacks->read(handle, data, palette_size + pixels_size);
+    if (bytes_read != palette_size + pixels_size) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read indexed image `%s` data", file);
+        free(data);
+        return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    }
+    if (!are_valid_indexes(data + palette_size, pixels_size, header->colors)) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "indexed image `%s` has indexes out of palette", file);
+        free(data);
+        return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    }
+
+    return (File_System_Chunk_t){
+            .type = FILE_SYSTEM_CHUNK_IMAGE,
+            .var = {
+                .image = {
+                        .width = header->width,
+                        .height = header->height,
+                        .pixels = data + palette_size,
+                        .palette = data,
+                        .colors = header->colors
+                    }
+                }
+        };
+}
+
+// Pre-indexed images are stored as-is, so that loading them is just a matter of reading the data. When the signature
+// doesn't match the file is decoded as a PNG from the same handle, with the probed bytes fed back to the decoder.
+static File_System_Chunk_t load_as_image(const File_System_Callbacks_t *callbacks, const void *context, const char *file, const void *entry)
 {
     size_t byte_to_read;
-    void *handle = callbacks->open(context, file, &byte_to_read);
+    void *handle = callbacks->open(context, file, entry, &byte_to_read);
     if (!handle) {
         return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
     }
 
+    Image_Header_t header;
+    size_t probed = byte_to_read >= sizeof(Image_Header_t) ? callbacks->read(handle, &header, sizeof(Image_Header_t)) : 0;
+    if (probed == sizeof(Image_Header_t) && strncmp(header.signature, IMAGE_SIGNATURE, IMAGE_SIGNATURE_LENGTH) == 0) {
+        File_System_Chunk_t chunk = load_as_indexed(callbacks, handle, byte_to_read, &header, file);
+        callbacks->close(handle);
+        return chunk;
+    }
+
     stbi_context_t stbi_context = {
-            .callbacks = callbacks, .handle = handle
+            .callbacks = callbacks, .handle = handle,
+            .prefix = (const uint8_t *)&header, .prefix_size = probed
         };
 
     int width, height, components;
     void *pixels = stbi_load_from_callbacks(&_io_callbacks, &stbi_context, &width, &height, &components, STBI_rgb_alpha);
     callbacks->close(handle);
     if (!pixels) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't decode surface from file `%s` (%s)", file, stbi_failure_reason());
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't decode surface from file `%s`", file); // No reason, as `stbi_failure_reason()` isn't thread-safe.
         return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
     }
 
@@ -205,6 +397,92 @@ static File_System_Chunk_t load_as_image(const File_System_Callbacks_t *callback
         };
 }
 
+// Mapped entries are accessed in-place: blobs and pre-indexed images borrow the memory (which is given back upon
+// `FS_release()`), while strings and PNG images are copied/decoded and the entry is unmapped right away.
+static File_System_Chunk_t load_mapped(const File_System_Mount_t *mount_point, const void *ptr, size_t size, const char *file, File_System_Chunk_Types_t type)
+{
+    File_System_Chunk_t chunk = (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+
+    if (type == FILE_SYSTEM_CHUNK_STRING) {
+        char *chars = malloc((size + 1) * sizeof(char));
+        if (!chars) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate %d bytes of memory", size + 1);
+        } else {
+            memcpy(chars, ptr, size);
+            chars[size] = '\0';
+            chunk = (File_System_Chunk_t){
+                    .type = FILE_SYSTEM_CHUNK_STRING,
+                    .var = {
+                        .string = {
+                                .chars = chars,
+                                .length = size
+                            }
+                    }
+                };
+        }
+    } else
+    if (type == FILE_SYSTEM_CHUNK_BLOB) {
+        return (File_System_Chunk_t){
+                .type = FILE_SYSTEM_CHUNK_BLOB,
+                .var = {
+                    .blob = {
+                            .ptr = (void *)ptr,
+                            .size = size
+                        }
+                },
+                .mapping = { .callbacks = mount_point->callbacks, .context = mount_point->context, .ptr = ptr }
+            };
+    } else
+    if (type == FILE_SYSTEM_CHUNK_IMAGE) {
+        const Image_Header_t *header = (const Image_Header_t *)ptr;
+        if (size >= sizeof(Image_Header_t) && strncmp(header->signature, IMAGE_SIGNATURE, IMAGE_SIGNATURE_LENGTH) == 0) {
+            size_t palette_size, pixels_size;
+            const uint8_t *palette = (const uint8_t *)ptr + sizeof(Image_Header_t);
+            if (!is_valid_header(header, size, &palette_size, &pixels_size)) {
+                Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "file `%s` is not a valid indexed image", file);
+            } else
+            if (!are_valid_indexes(palette + palette_size, pixels_size, header->colors)) {
+                Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "indexed image `%s` has indexes out of palette", file);
+            } else {
+                return (File_System_Chunk_t){
+                        .type = FILE_SYSTEM_CHUNK_IMAGE,
+                        .var = {
+                            .image = {
+                                    .width = header->width,
+                                    .height = header->height,
+                                    .pixels = (void *)(palette + palette_size),
+                                    .palette = (void *)palette,
+                                    .colors = header->colors
+                                }
+                            },
+                        .mapping = { .callbacks = mount_point->callbacks, .context = mount_point->context, .ptr = ptr }
+                    };
+            }
+        } else {
+            int width, height, components;
+            void *pixels = stbi_load_from_memory(ptr, (int)size, &width, &height, &components, STBI_rgb_alpha);
+            if (!pixels) {
+                Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't decode surface from file `%s`", file);
+            } else {
+                chunk = (File_System_Chunk_t){
+                        .type = FILE_SYSTEM_CHUNK_IMAGE,
+                        .var = {
+                            .image = {
+                                    .width = width,
+                                    .height = height,
+                                    .pixels = pixels
+                                }
+                            }
+                    };
+            }
+        }
+    }
+
+    mount_point->callbacks->unmap(mount_point->context, ptr);
+
+    return chunk;
+}
+
 #if PLATFORM_ID == PLATFORM_WINDOWS
   #define realpath(N,R) _fullpath((R),(N),PATH_MAX)
 #endif
@@ -212,6 +490,8 @@ static File_System_Chunk_t load_as_image(const File_System_Callbacks_t *callback
 bool FS_initialize(File_System_t *file_system, const char *base_path)
 {
     *file_system = (File_System_t){ 0 };
+    sh_new_arena(file_system->index);
+    pthread_mutex_init(&file_system->lock, NULL);
 
     char resolved[FILE_PATH_MAX]; // Using local buffer to avoid un-tracked `malloc()` for the syscall.
     char *ptr = realpath(base_path ? base_path : FILE_PATH_CURRENT_SZ, resolved);
@@ -260,6 +540,8 @@ bool FS_initialize(File_System_t *file_system, const char *base_path)
 
     _mount(file_system, resolved);
 
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "%d files indexed over %d mount-points", shlen(file_system->index), arrlen(file_system->mount_points));
+
     return true;
 }
 
@@ -271,38 +553,63 @@ void FS_terminate(File_System_t *file_system)
         mount_point->callbacks->deinit(mount_point->context);
     }
     arrfree(file_system->mount_points);
+
+    size_t entries = shlen(file_system->index);
+    for (size_t i = 0; i < entries; ++i) {
+        free(file_system->index[i].value.file);
+    }
+    shfree(file_system->index);
+
+    pthread_mutex_destroy(&file_system->lock);
 }
 
 File_System_Chunk_t FS_load(const File_System_t *file_system, const char *file, File_System_Chunk_Types_t type)
 {
-    File_System_Chunk_t chunk = (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    char key[FILE_PATH_MAX];
+    if (!_normalize(file, key)) {
+        return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    }
 
-    size_t count = arrlen(file_system->mount_points);
-    for (int i = count - 1; i >= 0; --i) { // Backward search to enable resource override in multi-archives.
-        File_System_Mount_t *mount_point = &file_system->mount_points[i];
+    pthread_mutex_t *lock = (pthread_mutex_t *)&file_system->lock;
+    pthread_mutex_lock(lock);
+    File_System_Index_t *file_system_index = file_system->index; // Lookup updates the hash-map temporary slot.
+    ptrdiff_t index = shgeti(file_system_index, key);
+    pthread_mutex_unlock(lock);
+    if (index == -1) {
+        return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
+    }
 
-        if (!mount_point->callbacks->exists(mount_point->context, file)) {
-            continue;
-        }
+    const File_System_Index_Entry_t *entry = &file_system_index[index].value; // The index isn't altered after mounting.
+    const File_System_Mount_t *mount_point = &file_system->mount_points[entry->mount_point];
 
-        if (type == FILE_SYSTEM_CHUNK_STRING) {
-            chunk = load_as_string(mount_point->callbacks, mount_point->context, file);
-        } else
-        if (type == FILE_SYSTEM_CHUNK_BLOB) {
-            chunk = load_as_binary(mount_point->callbacks, mount_point->context, file);
-        } else
-        if (type == FILE_SYSTEM_CHUNK_IMAGE) {
-            chunk = load_as_image(mount_point->callbacks, mount_point->context, file);
+    if (mount_point->callbacks->map) {
+        size_t size;
+        const void *ptr = mount_point->callbacks->map(mount_point->context, entry->file, entry->entry, &size);
+        if (ptr) {
+            return load_mapped(mount_point, ptr, size, entry->file, type);
         }
+    }
 
-        break;
+    if (type == FILE_SYSTEM_CHUNK_STRING) {
+        return load_as_string(mount_point->callbacks, mount_point->context, entry->file, entry->entry);
+    } else
+    if (type == FILE_SYSTEM_CHUNK_BLOB) {
+        return load_as_binary(mount_point->callbacks, mount_point->context, entry->file, entry->entry);
+    } else
+    if (type == FILE_SYSTEM_CHUNK_IMAGE) {
+        return load_as_image(mount_point->callbacks, mount_point->context, entry->file, entry->entry);
     }
 
-    return chunk;
+    return (File_System_Chunk_t){ .type = FILE_SYSTEM_CHUNK_NULL };
 }
 
 void FS_release(File_System_Chunk_t chunk)
 {
+    if (chunk.mapping.ptr) { // Borrowed data, just give it back.
+        chunk.mapping.callbacks->unmap(chunk.mapping.context, chunk.mapping.ptr);
+        return;
+    }
+
     if (chunk.type == FILE_SYSTEM_CHUNK_STRING) {
         free(chunk.var.string.chars);
     } else
@@ -310,6 +617,10 @@ void FS_release(File_System_Chunk_t chunk)
         free(chunk.var.blob.ptr);
     } else
     if (chunk.type == FILE_SYSTEM_CHUNK_IMAGE) {
-        stbi_image_free(chunk.var.image.pixels);
+        if (chunk.var.image.colors > 0) {
+            free(chunk.var.image.palette); // Indexed images are allocated as a single block.
+        } else {
+            stbi_image_free(chunk.var.image.pixels);
+        }
     }
 }
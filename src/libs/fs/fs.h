@@ -25,6 +25,7 @@
 
 #include <core/platform.h>
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -53,15 +54,21 @@
 #define FILE_SYSTEM_PATH_SEPARATOR    '/'
 #define FILE_SYSTEM_PATH_SEPARATOR_SZ "/"
 
+// Files are enumerated along with an opaque entry (possibly `NULL`), that is handed back to the mount-point when the
+// file is accessed so that it doesn't need to be looked-up again.
+typedef void (*File_System_Scan_Callback_t)(void *user_data, const char *file, const void *entry);
+
 typedef struct _File_System_Callbacks_t {
    void * (*init)  (const char *path);
    void   (*deinit)(void *context);
-   bool   (*exists)  (const void *context, const char *file);
-   void * (*open) (const void *context, const char *file, size_t *size_in_bytes);
+   void * (*open) (const void *context, const char *file, const void *entry, size_t *size_in_bytes);
    size_t (*read) (void *handle, void *buffer, size_t bytes_requested);
    void   (*skip) (void *handle, int offset);
    bool   (*eof)  (void *handle);
    void   (*close)(void *handle);
+   const void * (*map)(void *context, const char *file, const void *entry, size_t *size_in_bytes); // Optional, borrowed read-only memory (`NULL` to fall back to `open()`).
+   void   (*unmap)(void *context, const void *ptr);
+   void   (*scan)(const void *context, File_System_Scan_Callback_t callback, void *user_data); // Enumerates every file.
 } File_System_Callbacks_t;
 
 typedef struct _File_System_Mount_t {
@@ -69,8 +76,21 @@ typedef struct _File_System_Mount_t {
     void *context;
 } File_System_Mount_t;
 
+typedef struct _File_System_Index_Entry_t {
+    size_t mount_point;
+    char *file; // As named by the mount-point, which might differ (e.g. in case) from the index key.
+    const void *entry; // As reported by the mount-point when scanning.
+} File_System_Index_Entry_t;
+
+typedef struct _File_System_Index_t {
+    char *key; // Normalized path.
+    File_System_Index_Entry_t value;
+} File_System_Index_t;
+
 typedef struct _File_System_t {
     File_System_Mount_t *mount_points;
+    File_System_Index_t *index; // Maps every file to the (latest mounted) mount-point providing it.
+    pthread_mutex_t lock; // Files can be loaded from any thread, and lookups update the hash-map temporary slot.
 } File_System_t;
 
 typedef enum _File_System_Chunk_Types_t {
@@ -93,9 +113,16 @@ typedef struct _File_System_Chunk_t {
       } blob;
       struct {
         size_t width, height;
-        void *pixels;
+        void *pixels; // Either RGBA quadruplets or (when `colors` is non-zero) one palette index per pixel.
+        void *palette; // RGBA quadruplets, `colors` entries long.
+        size_t colors;
       } image;
     } var;
+    struct { // When `ptr` is not `NULL` the chunk data is borrowed from a mount-point, and released by unmapping it.
+      const File_System_Callbacks_t *callbacks;
+      void *context;
+      const void *ptr;
+    } mapping;
 } File_System_Chunk_t;
 
 extern bool FS_initialize(File_System_t *file_system, const char *base_path);
@@ -22,22 +22,44 @@
 
 #include "pak.h"
 
+#include <config.h>
 #include <libs/log.h>
+#include <libs/lz4.h>
 #include <libs/md5.h>
 #include <libs/rc4.h>
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#if PLATFORM_ID != PLATFORM_WINDOWS
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+
+  #define __PAK_MMAP__
+  #define __PAK_PREAD__
+#endif
 
 #define LOG_CONTEXT "fs-pak"
 
 #define PAK_SIGNATURE           "TOFUPAK!"
 #define PAK_SIGNATURE_LENGTH    8
 
+#define PAK_VERSION_0           0x00
+#define PAK_VERSION_1           0x01
+
 #define PAK_FLAG_ENCRYPTED      0x0001
 
+#define PAK_ENTRY_FLAG_COMPRESSED   0x0001
+
+// Compressed entries are split into blocks of (at most) `PAK_BLOCK_SIZE` bytes, each one independently compressed
+// and prefixed by its (stored) size. Blocks that don't shrink are stored as-is and flagged.
+#define PAK_BLOCK_SIZE          65536
+#define PAK_BLOCK_FLAG_STORED   0x80000000
+
 #pragma pack(push, 1)
 typedef struct _Pak_Header_t {
     char signature[PAK_SIGNATURE_LENGTH];
@@ -47,40 +69,57 @@ typedef struct _Pak_Header_t {
     uint32_t entries;
 } Pak_Header_t;
 
-typedef struct _Pak_Entry_Header_t {
+typedef struct _Pak_Entry_Header_t { // Version 0, entries are interleaved with the data.
     uint16_t __reserved;
     uint16_t name; // The entry header is followed by `name` chars and `size` bytes.
     uint32_t size;
 } Pak_Entry_Header_t;
+
+typedef struct _Pak_Directory_Entry_t { // Version 1, the whole directory is at the end of the archive.
+    uint16_t flags;
+    uint16_t name; // The directory entry is followed by `name` chars.
+    uint32_t offset;
+    uint32_t size;
+    uint32_t stored; // Bytes occupied in the archive, i.e. after compression.
+} Pak_Directory_Entry_t;
 #pragma pack(pop)
 
 typedef struct _Pak_Entry_t {
     char *name;
     long offset;
     size_t size;
+    size_t stored;
+    bool compressed;
 } Pak_Entry_t;
 
 typedef struct _Pak_Context_t {
     char archive_path[FILE_PATH_MAX];
+    FILE *stream; // Shared by all the handles, which track their own offsets.
     size_t entries;
     Pak_Entry_t *directory;
     bool encrypted;
+    const uint8_t *mapping; // Whole archive image, only for unencrypted archives (and when the platform supports it).
+    size_t mapping_size;
+    size_t references; // The mount-point itself plus every entry currently borrowed from the mapping.
+    pthread_mutex_t lock; // Entries can be loaded from any thread, guards `references` (and the stream, when seeking).
 } Pak_Context_t;
 
 typedef struct _Pak_Handle_t {
-    FILE *stream;
+    const Pak_Context_t *context;
+    const Pak_Entry_t *entry;
+    long offset; // Archive offset of the first byte not yet fetched (into the read-ahead buffer).
     long end_of_stream;
     bool encrypted;
     rc4_context_t cipher_context;
+    size_t index, length; // Bytes in `[index, length)` are fetched but not yet read.
+    uint8_t buffer[PAK_READ_AHEAD_SIZE];
+    // Compressed entries are decoded one block at a time, the fields mimic the ones above (in the decoded space).
+    size_t block_offset;
+    size_t block_index, block_length;
+    uint8_t *block;
+    uint8_t *packed;
 } Pak_Handle_t;
 
-static int _pak_entry_compare(const void *lhs, const void *rhs)
-{
-    const Pak_Entry_t *l = (const Pak_Entry_t *)lhs;
-    const Pak_Entry_t *r = (const Pak_Entry_t *)rhs;
-    return strcasecmp(l->name, r->name);
-}
-
 // Encryption is implemented throught a RC4 stream cipher.
 // The key is the MD5 digest of the entry name (w/ relative path).
 static void _initialize_context(rc4_context_t *cipher_context, const char *file)
@@ -99,37 +138,91 @@ static void _initialize_context(rc4_context_t *cipher_context, const char *file)
 #endif
 }
 
-static void *pakio_init(const char *path)
+// Positional reads don't alter the (shared) stream position, so handles don't interfere with each other. Where
+// `pread()` isn't available we fall back to seeking the shared stream before each read (atomically).
+static size_t _read_at(const Pak_Context_t *pak_context, void *buffer, size_t bytes_requested, long offset)
 {
-    FILE *stream = fopen(path, "rb");
-    if (!stream) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't access file `%s`", path);
-        return NULL;
+#ifdef __PAK_PREAD__
+    ssize_t bytes_read = pread(fileno(pak_context->stream), buffer, bytes_requested, (off_t)offset);
+    return bytes_read < 0 ? 0 : (size_t)bytes_read;
+#else
+    pthread_mutex_t *lock = (pthread_mutex_t *)&pak_context->lock;
+    pthread_mutex_lock(lock);
+    size_t bytes_read = 0;
+    if (fseek(pak_context->stream, offset, SEEK_SET) == 0) {
+        bytes_read = fread(buffer, sizeof(uint8_t), bytes_requested, pak_context->stream);
     }
+    pthread_mutex_unlock(lock);
+    return bytes_read;
+#endif
+}
 
-    Pak_Header_t header;
-    int headers_read = fread(&header, sizeof(Pak_Header_t), 1, stream);
-    if (headers_read != 1) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read file `%s` header", path);
-        fclose(stream);
+#ifdef __PAK_MMAP__
+static const uint8_t *_map_archive(FILE *stream, const char *path, size_t *size)
+{
+    int fd = fileno(stream);
+
+    struct stat fd_stat;
+    if (fstat(fd, &fd_stat) == -1 || fd_stat.st_size == 0) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't get size of file `%s` for mapping", path);
         return NULL;
     }
-    if (strncmp(header.signature, PAK_SIGNATURE, sizeof(header.signature)) != 0) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "file `%s` is not a valid archive", path);
-        fclose(stream);
+
+    void *ptr = mmap(NULL, (size_t)fd_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't map file `%s`", path);
         return NULL;
     }
 
-    Pak_Entry_t *directory = malloc(sizeof(Pak_Entry_t) * header.entries);
-    if (!directory) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate #%d directory entries", header.entries);
-        fclose(stream);
+    *size = (size_t)fd_stat.st_size;
+    return (const uint8_t *)ptr;
+}
+#endif
+
+static void _release(Pak_Context_t *pak_context)
+{
+    pthread_mutex_lock(&pak_context->lock);
+    size_t references = --pak_context->references;
+    pthread_mutex_unlock(&pak_context->lock);
+    if (references > 0) {
+        return;
+    }
+
+    pthread_mutex_destroy(&pak_context->lock);
+
+#ifdef __PAK_MMAP__
+    if (pak_context->mapping) {
+        munmap((void *)pak_context->mapping, pak_context->mapping_size);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "archive `%s` unmapped", pak_context->archive_path);
+    }
+#endif
+    fclose(pak_context->stream);
+    for (size_t i = 0; i < pak_context->entries; ++i) {
+        free(pak_context->directory[i].name);
+    }
+    free(pak_context->directory);
+    free(pak_context);
+}
+
+static char *_read_name(FILE *stream, size_t length)
+{
+    char *name = malloc((length + 1) * sizeof(char));
+    if (!name) {
         return NULL;
     }
-    memset(directory, 0x00, sizeof(Pak_Entry_t) * header.entries);
+    size_t chars_read = fread(name, sizeof(char), length, stream);
+    if (chars_read != length) {
+        free(name);
+        return NULL;
+    }
+    name[length] = '\0';
+    return name;
+}
 
+static size_t _read_directory_v0(FILE *stream, Pak_Entry_t *directory, size_t count)
+{
     size_t entries = 0;
-    for (size_t i = 0; i < header.entries; ++i) {
+    for (size_t i = 0; i < count; ++i) {
         Pak_Entry_Header_t entry_header;
         size_t entries_read = fread(&entry_header, sizeof(Pak_Entry_Header_t), 1, stream);
         if (entries_read != 1) {
@@ -137,30 +230,101 @@ static void *pakio_init(const char *path)
             break;
         }
 
-        char *entry_name = malloc((entry_header.name + 1) * sizeof(char));
+        char *entry_name = _read_name(stream, entry_header.name);
         if (!entry_name) {
-            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate memory for entry #%d", i);
-            break;
-        }
-        size_t chars_read = fread(entry_name, sizeof(char), entry_header.name, stream);
-        if (chars_read != entry_header.name) {
             Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read name for entry #%d", i);
             break;
         }
-        entry_name[entry_header.name] = '\0';
 
         directory[i] = (Pak_Entry_t){
                 .name = entry_name,
                 .offset = ftell(stream),
                 .size = entry_header.size,
+                .stored = entry_header.size,
+                .compressed = false
             };
 
         fseek(stream, entry_header.size, SEEK_CUR); // Skip the curren entry data and move the next entry header.
 
         entries += 1;
     }
+    return entries;
+}
 
-    fclose(stream);
+static size_t _read_directory_v1(FILE *stream, Pak_Entry_t *directory, size_t count)
+{
+    uint32_t directory_offset; // Follows the header, the directory is written last.
+    if (fread(&directory_offset, sizeof(uint32_t), 1, stream) != 1 || fseek(stream, directory_offset, SEEK_SET) != 0) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't locate directory");
+        return 0;
+    }
+
+    size_t entries = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Pak_Directory_Entry_t directory_entry;
+        size_t entries_read = fread(&directory_entry, sizeof(Pak_Directory_Entry_t), 1, stream);
+        if (entries_read != 1) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read directory entry #%d", i);
+            break;
+        }
+
+        char *entry_name = _read_name(stream, directory_entry.name);
+        if (!entry_name) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read name for entry #%d", i);
+            break;
+        }
+
+        directory[i] = (Pak_Entry_t){
+                .name = entry_name,
+                .offset = directory_entry.offset,
+                .size = directory_entry.size,
+                .stored = directory_entry.stored,
+                .compressed = directory_entry.flags & PAK_ENTRY_FLAG_COMPRESSED
+            };
+
+        entries += 1;
+    }
+    return entries;
+}
+
+static void *pakio_init(const char *path)
+{
+    FILE *stream = fopen(path, "rb");
+    if (!stream) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't access file `%s`", path);
+        return NULL;
+    }
+
+    Pak_Header_t header;
+    int headers_read = fread(&header, sizeof(Pak_Header_t), 1, stream);
+    if (headers_read != 1) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read file `%s` header", path);
+        fclose(stream);
+        return NULL;
+    }
+    if (strncmp(header.signature, PAK_SIGNATURE, sizeof(header.signature)) != 0) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "file `%s` is not a valid archive", path);
+        fclose(stream);
+        return NULL;
+    }
+
+    if (header.version != PAK_VERSION_0 && header.version != PAK_VERSION_1) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "archive `%s` version %d is not supported", path, header.version);
+        fclose(stream);
+        return NULL;
+    }
+
+    Pak_Entry_t *directory = malloc(sizeof(Pak_Entry_t) * header.entries);
+    if (!directory) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate #%d directory entries", header.entries);
+        fclose(stream);
+        return NULL;
+    }
+    memset(directory, 0x00, sizeof(Pak_Entry_t) * header.entries);
+
+    size_t entries = header.version == PAK_VERSION_1
+        ? _read_directory_v1(stream, directory, header.entries)
+        : _read_directory_v0(stream, directory, header.entries);
 
     if (entries < header.entries) {
         for (size_t i = 0; i < entries; ++i) {
@@ -168,12 +332,10 @@ static void *pakio_init(const char *path)
         }
         free(directory);
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "directory w/ #%d entries deallocated", entries);
+        fclose(stream);
         return NULL;
     }
 
-    qsort(directory, header.entries, sizeof(Pak_Entry_t), _pak_entry_compare); // Keep sorted to use binary-search.
-    Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "directory w/ #%d entries sorted", entries);
-
     Pak_Context_t *pak_context = malloc(sizeof(Pak_Context_t));
     if (!pak_context) {
         Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate context");
@@ -182,17 +344,29 @@ static void *pakio_init(const char *path)
         }
         free(directory);
         Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "directory w/ #%d entries deallocated", entries);
+        fclose(stream);
         return NULL;
     }
 
     strcpy(pak_context->archive_path, path);
+    pak_context->stream = stream; // Kept open for the whole mount-point lifetime.
     pak_context->entries = entries;
     pak_context->directory = directory;
     pak_context->encrypted = header.flags & PAK_FLAG_ENCRYPTED;
+    pak_context->mapping = NULL;
+    pak_context->mapping_size = 0;
+    pak_context->references = 1;
+    pthread_mutex_init(&pak_context->lock, NULL);
+
+#ifdef __PAK_MMAP__
+    if (!pak_context->encrypted) { // Encrypted entries need to be deciphered into a buffer anyway.
+        pak_context->mapping = _map_archive(stream, path, &pak_context->mapping_size);
+    }
+#endif
 
-    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "I/O initialized for archive `%s` w/ %d entries (%sencrypted)",
-        path, entries,
-        pak_context->encrypted ? "" : "un");
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "I/O initialized for archive `%s` (v%d) w/ %d entries (%sencrypted, %smapped)",
+        path, header.version, entries,
+        pak_context->encrypted ? "" : "un", pak_context->mapping ? "" : "not ");
 
     return pak_context;
 }
@@ -201,93 +375,277 @@ static void pakio_deinit(void *context)
 {
     Pak_Context_t *pak_context = (Pak_Context_t *)context;
 
-    for (size_t i = 0; i < pak_context->entries; ++i) {
-        free(pak_context->directory[i].name);
-    }
-    free(pak_context->directory);
-    free(pak_context);
+    _release(pak_context); // Deferred until every borrowed entry has been unmapped.
 
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "I/O deinitialized");
 }
 
-static bool pakio_exists(const void *context, const char *file)
+static void pakio_scan(const void *context, File_System_Scan_Callback_t callback, void *user_data)
 {
     const Pak_Context_t *pak_context = (const Pak_Context_t *)context;
 
-    const Pak_Entry_t key = { .name = (char *)file };
-    Pak_Entry_t *entry = bsearch((const void *)&key, pak_context->directory, pak_context->entries, sizeof(Pak_Entry_t), _pak_entry_compare);
-    
-    return entry;
+    for (size_t i = 0; i < pak_context->entries; ++i) {
+        callback(user_data, pak_context->directory[i].name, &pak_context->directory[i]);
+    }
 }
 
-static void *pakio_open(const void *context, const char *file, size_t *size_in_bytes)
+static void *pakio_open(const void *context, const char *file, const void *entry, size_t *size_in_bytes)
 {
     const Pak_Context_t *pak_context = (const Pak_Context_t *)context;
-
-    const Pak_Entry_t key = { .name = (char *)file };
-    Pak_Entry_t *entry = bsearch((const void *)&key, pak_context->directory, pak_context->entries, sizeof(Pak_Entry_t), _pak_entry_compare);
-    if (!entry) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't find entry `%s`", file);
-        return NULL;
-    }
-
-    FILE *stream = fopen(pak_context->archive_path, "rb"); // Always in binary mode, line-terminators aren't an issue.
-    if (!stream) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't access file `%s`", pak_context->archive_path);
-        return NULL;
-    }
-
-    fseek(stream, entry->offset, SEEK_SET); // Move to the found entry position into the file.
-    Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "entry `%s` found at offset %d in file `%s`", file, entry->offset, pak_context->archive_path);
+    const Pak_Entry_t *pak_entry = (const Pak_Entry_t *)entry; // Directory entry, as reported when scanning.
 
     Pak_Handle_t *pak_handle = malloc(sizeof(Pak_Handle_t));
     if (!pak_handle) {
         Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate handle for entry `%s`", file);
-        fclose(stream);
         return NULL;
     }
-    *pak_handle = (Pak_Handle_t){
-            .stream = stream,
-            .end_of_stream = entry->offset + entry->size,
-            .encrypted = pak_context->encrypted
-        };
+    pak_handle->context = pak_context; // Field-wise, so that the read-ahead buffer isn't needlessly cleared.
+    pak_handle->entry = pak_entry;
+    pak_handle->offset = pak_entry->offset;
+    pak_handle->end_of_stream = pak_entry->offset + pak_entry->stored;
+    pak_handle->encrypted = pak_context->encrypted;
+    pak_handle->index = 0;
+    pak_handle->length = 0;
+    pak_handle->block_offset = 0;
+    pak_handle->block_index = 0;
+    pak_handle->block_length = 0;
+    pak_handle->block = NULL;
+    pak_handle->packed = NULL;
+
+    if (pak_entry->compressed) {
+        pak_handle->block = malloc(PAK_BLOCK_SIZE * 2);
+        if (!pak_handle->block) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate block buffers for entry `%s`", file);
+            free(pak_handle);
+            return NULL;
+        }
+        pak_handle->packed = pak_handle->block + PAK_BLOCK_SIZE;
+    }
 
     if (pak_context->encrypted) {
-        _initialize_context(&pak_handle->cipher_context, entry->name);
+        _initialize_context(&pak_handle->cipher_context, pak_entry->name);
     }
 
-    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "entry `%s` opened w/ handle %p (%d bytes)", file, pak_handle, entry->size);
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "entry `%s` opened w/ handle %p (%d bytes, %d stored)", file, pak_handle, pak_entry->size, pak_entry->stored);
 
-    *size_in_bytes = entry->size;
+    *size_in_bytes = pak_entry->size;
 
     return pak_handle;
 }
 
-static size_t pakio_read(void *handle, void *buffer, size_t bytes_requested)
+// Fetches (and deciphers, if needed) the next bytes of the entry. Since the cipher is a stream one, bytes are always
+// fetched in order.
+static size_t _fetch(Pak_Handle_t *pak_handle, void *buffer, size_t bytes_requested)
 {
-    Pak_Handle_t *pak_handle = (Pak_Handle_t *)handle;
-
-    long position = ftell(pak_handle->stream);
-    if (position == -1) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't get current position for handle %p", handle);
-        return 0;
-    }
-
-    size_t bytes_available = pak_handle->end_of_stream - position;
+    size_t bytes_available = pak_handle->end_of_stream - pak_handle->offset;
 
     size_t bytes_to_read = bytes_requested;
     if (bytes_to_read > bytes_available) {
         bytes_to_read = bytes_available;
     }
+    if (bytes_to_read == 0) {
+        return 0;
+    }
 
-    size_t bytes_read = fread(buffer, sizeof(uint8_t), bytes_to_read, pak_handle->stream);
-    Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "%d bytes read out of %d (%d requested)", bytes_read, bytes_to_read, bytes_requested);
+    const Pak_Context_t *pak_context = pak_handle->context;
+
+    size_t bytes_read;
+    if (pak_context->mapping && (size_t)pak_handle->offset + bytes_to_read <= pak_context->mapping_size) {
+        memcpy(buffer, pak_context->mapping + pak_handle->offset, bytes_to_read);
+        bytes_read = bytes_to_read;
+    } else {
+        bytes_read = _read_at(pak_context, buffer, bytes_to_read, pak_handle->offset);
+    }
+    Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "%d bytes fetched out of %d (%d requested)", bytes_read, bytes_to_read, bytes_requested);
 
     if (pak_handle->encrypted) {
         rc4_process(&pak_handle->cipher_context, buffer, bytes_read);
         Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "%d bytes decrypted", bytes_read);
     }
 
+    pak_handle->offset += bytes_read;
+
+    return bytes_read;
+}
+
+static size_t _read(Pak_Handle_t *pak_handle, void *buffer, size_t bytes_requested)
+{
+    uint8_t *ptr = (uint8_t *)buffer;
+    size_t bytes_read = 0;
+    while (bytes_read < bytes_requested) {
+        size_t bytes_needed = bytes_requested - bytes_read;
+
+        if (pak_handle->index == pak_handle->length) { // Buffer exhausted.
+            if (bytes_needed >= PAK_READ_AHEAD_SIZE) { // Large reads go straight to the destination.
+                pak_handle->index = pak_handle->length = 0; // Buffer content is no more adjacent to the offset.
+                size_t bytes_fetched = _fetch(pak_handle, ptr + bytes_read, bytes_needed);
+                if (bytes_fetched == 0) {
+                    break;
+                }
+                bytes_read += bytes_fetched;
+                continue;
+            }
+
+            size_t bytes_fetched = _fetch(pak_handle, pak_handle->buffer, PAK_READ_AHEAD_SIZE);
+            if (bytes_fetched == 0) {
+                break;
+            }
+            pak_handle->index = 0;
+            pak_handle->length = bytes_fetched;
+        }
+
+        size_t bytes_buffered = pak_handle->length - pak_handle->index;
+        size_t bytes_to_copy = bytes_needed < bytes_buffered ? bytes_needed : bytes_buffered;
+        memcpy(ptr + bytes_read, pak_handle->buffer + pak_handle->index, bytes_to_copy);
+        pak_handle->index += bytes_to_copy;
+        bytes_read += bytes_to_copy;
+    }
+
+    Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "%d bytes read (%d requested)", bytes_read, bytes_requested);
+
+    return bytes_read;
+}
+
+static long _tell(const Pak_Handle_t *pak_handle)
+{
+    return pak_handle->offset - (long)(pak_handle->length - pak_handle->index); // Archive offset of the next byte.
+}
+
+static void _seek(Pak_Handle_t *pak_handle, long target)
+{
+    if (target < pak_handle->entry->offset) {
+        target = pak_handle->entry->offset;
+    } else
+    if (target > pak_handle->end_of_stream) {
+        target = pak_handle->end_of_stream;
+    }
+
+    long buffer_start = pak_handle->offset - (long)pak_handle->length;
+    if (target >= buffer_start && target <= pak_handle->offset) { // Within the read-ahead buffer.
+        pak_handle->index = (size_t)(target - buffer_start);
+        return;
+    }
+
+    pak_handle->index = pak_handle->length = 0;
+
+    if (!pak_handle->encrypted) {
+        pak_handle->offset = target;
+        return;
+    }
+
+    // The cipher can't be seeked: restart it when moving backward, then decipher up to the target.
+    if (target < pak_handle->offset) {
+        _initialize_context(&pak_handle->cipher_context, pak_handle->entry->name);
+        pak_handle->offset = pak_handle->entry->offset;
+    }
+    while (pak_handle->offset < target) {
+        size_t bytes_to_skip = (size_t)(target - pak_handle->offset);
+        if (bytes_to_skip > PAK_READ_AHEAD_SIZE) {
+            bytes_to_skip = PAK_READ_AHEAD_SIZE;
+        }
+        if (_fetch(pak_handle, pak_handle->buffer, bytes_to_skip) == 0) {
+            break;
+        }
+    }
+}
+
+// Decodes the next block of a compressed entry into `buffer`, returning its size (zero at the end or on errors).
+static size_t _decode(Pak_Handle_t *pak_handle, uint8_t *buffer)
+{
+    size_t bytes_expected = pak_handle->entry->size - pak_handle->block_offset;
+    if (bytes_expected > PAK_BLOCK_SIZE) {
+        bytes_expected = PAK_BLOCK_SIZE;
+    }
+    if (bytes_expected == 0) {
+        return 0;
+    }
+
+    uint32_t block_header;
+    if (_read(pak_handle, &block_header, sizeof(uint32_t)) != sizeof(uint32_t)) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read block header for entry `%s`", pak_handle->entry->name);
+        return 0;
+    }
+
+    size_t bytes_stored = block_header & ~PAK_BLOCK_FLAG_STORED;
+    if (block_header & PAK_BLOCK_FLAG_STORED) {
+        if (bytes_stored != bytes_expected || _read(pak_handle, buffer, bytes_stored) != bytes_stored) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't read block for entry `%s`", pak_handle->entry->name);
+            return 0;
+        }
+    } else {
+        if (bytes_stored > PAK_BLOCK_SIZE || _read(pak_handle, pak_handle->packed, bytes_stored) != bytes_stored
+            || lz4_decompress(pak_handle->packed, bytes_stored, buffer, bytes_expected) != bytes_expected) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't decode block for entry `%s`", pak_handle->entry->name);
+            return 0;
+        }
+    }
+
+    pak_handle->block_offset += bytes_expected;
+
+    return bytes_expected;
+}
+
+// Moves past the next block without decoding it, only the block header is read.
+static bool _pass(Pak_Handle_t *pak_handle)
+{
+    size_t bytes_expected = pak_handle->entry->size - pak_handle->block_offset;
+    if (bytes_expected > PAK_BLOCK_SIZE) {
+        bytes_expected = PAK_BLOCK_SIZE;
+    }
+
+    uint32_t block_header;
+    if (_read(pak_handle, &block_header, sizeof(uint32_t)) != sizeof(uint32_t)) {
+        return false;
+    }
+    _seek(pak_handle, _tell(pak_handle) + (long)(block_header & ~PAK_BLOCK_FLAG_STORED));
+
+    pak_handle->block_offset += bytes_expected;
+
+    return true;
+}
+
+static size_t pakio_read(void *handle, void *buffer, size_t bytes_requested)
+{
+    Pak_Handle_t *pak_handle = (Pak_Handle_t *)handle;
+
+    if (!pak_handle->entry->compressed) {
+        return _read(pak_handle, buffer, bytes_requested);
+    }
+
+    uint8_t *ptr = (uint8_t *)buffer;
+    size_t bytes_read = 0;
+    while (bytes_read < bytes_requested) {
+        size_t bytes_needed = bytes_requested - bytes_read;
+
+        if (pak_handle->block_index == pak_handle->block_length) { // Block exhausted.
+            size_t bytes_remaining = pak_handle->entry->size - pak_handle->block_offset;
+            if (bytes_needed >= bytes_remaining || bytes_needed >= PAK_BLOCK_SIZE) { // Whole blocks are decoded in place.
+                pak_handle->block_index = pak_handle->block_length = 0;
+                size_t bytes_decoded = _decode(pak_handle, ptr + bytes_read);
+                if (bytes_decoded == 0) {
+                    break;
+                }
+                bytes_read += bytes_decoded;
+                continue;
+            }
+
+            size_t bytes_decoded = _decode(pak_handle, pak_handle->block);
+            if (bytes_decoded == 0) {
+                break;
+            }
+            pak_handle->block_index = 0;
+            pak_handle->block_length = bytes_decoded;
+        }
+
+        size_t bytes_buffered = pak_handle->block_length - pak_handle->block_index;
+        size_t bytes_to_copy = bytes_needed < bytes_buffered ? bytes_needed : bytes_buffered;
+        memcpy(ptr + bytes_read, pak_handle->block + pak_handle->block_index, bytes_to_copy);
+        pak_handle->block_index += bytes_to_copy;
+        bytes_read += bytes_to_copy;
+    }
+
+    Log_write(LOG_LEVELS_TRACE, LOG_CONTEXT, "%d bytes read (%d requested)", bytes_read, bytes_requested);
+
     return bytes_read;
 }
 
@@ -295,41 +653,122 @@ static void pakio_skip(void *handle, int offset)
 {
     Pak_Handle_t *pak_handle = (Pak_Handle_t *)handle;
 
-    fseek(pak_handle->stream, offset, SEEK_CUR);
+    if (!pak_handle->entry->compressed) {
+        _seek(pak_handle, _tell(pak_handle) + offset);
+        return;
+    }
+
+    long position = (long)(pak_handle->block_offset - (pak_handle->block_length - pak_handle->block_index));
+    long target = position + offset;
+    if (target < 0) {
+        target = 0;
+    } else
+    if (target > (long)pak_handle->entry->size) {
+        target = (long)pak_handle->entry->size;
+    }
+
+    long block_start = (long)(pak_handle->block_offset - pak_handle->block_length);
+    if (target >= block_start && target <= (long)pak_handle->block_offset) { // Within the current block.
+        pak_handle->block_index = (size_t)(target - block_start);
+        return;
+    }
+
+    pak_handle->block_index = pak_handle->block_length = 0;
+
+    if (target < (long)pak_handle->block_offset) { // Blocks are chained, rewind to the first one.
+        _seek(pak_handle, pak_handle->entry->offset);
+        pak_handle->block_offset = 0;
+    }
+
+    while ((long)pak_handle->block_offset < target) {
+        size_t bytes_remaining = pak_handle->entry->size - pak_handle->block_offset;
+        size_t bytes_expected = bytes_remaining < PAK_BLOCK_SIZE ? bytes_remaining : PAK_BLOCK_SIZE;
+        if ((long)(pak_handle->block_offset + bytes_expected) <= target) { // Skipped blocks aren't decoded.
+            if (!_pass(pak_handle)) {
+                break;
+            }
+            continue;
+        }
+
+        size_t bytes_decoded = _decode(pak_handle, pak_handle->block);
+        if (bytes_decoded == 0) {
+            break;
+        }
+        pak_handle->block_length = bytes_decoded;
+        pak_handle->block_index = (size_t)(target - (long)(pak_handle->block_offset - bytes_decoded));
+    }
 }
 
 static bool pakio_eof(void *handle)
 {
     Pak_Handle_t *pak_handle = (Pak_Handle_t *)handle;
 
-    long position = ftell(pak_handle->stream);
-    if (position == -1) {
-        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't get current position for handle %p", handle);
-        return true;
+    if (pak_handle->entry->compressed) {
+        return pak_handle->block_index == pak_handle->block_length && pak_handle->block_offset >= pak_handle->entry->size;
     }
 
-    return position >= pak_handle->end_of_stream;
+    return pak_handle->index == pak_handle->length && pak_handle->offset >= pak_handle->end_of_stream;
 }
 
 static void pakio_close(void *handle)
 {
     Pak_Handle_t *pak_handle = (Pak_Handle_t *)handle;
 
-    fclose(pak_handle->stream);
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "entry w/ handle %p closed", pak_handle);
+
+    free(pak_handle->block); // The packed buffer is part of the same allocation.
     free(pak_handle);
+}
 
-    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "entry w/ handle %p closed", pak_handle);
+static const void *pakio_map(void *context, const char *file, const void *entry, size_t *size_in_bytes)
+{
+    Pak_Context_t *pak_context = (Pak_Context_t *)context;
+    const Pak_Entry_t *pak_entry = (const Pak_Entry_t *)entry;
+
+    if (!pak_context->mapping) {
+        return NULL;
+    }
+
+    if (pak_entry->compressed) { // Needs decoding, will be streamed.
+        return NULL;
+    }
+
+    if ((size_t)pak_entry->offset + pak_entry->size > pak_context->mapping_size) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "entry `%s` exceeds archive `%s` size", file, pak_context->archive_path);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pak_context->lock);
+    pak_context->references += 1;
+    pthread_mutex_unlock(&pak_context->lock);
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "entry `%s` mapped at offset %d (%d bytes)", file, pak_entry->offset, pak_entry->size);
+
+    *size_in_bytes = pak_entry->size;
+
+    return pak_context->mapping + pak_entry->offset;
+}
+
+static void pakio_unmap(void *context, const void *ptr)
+{
+    Pak_Context_t *pak_context = (Pak_Context_t *)context;
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "entry at %p unmapped", ptr);
+
+    _release(pak_context);
 }
 
 const File_System_Callbacks_t *pakio_callbacks = &(File_System_Callbacks_t){
     pakio_init,
     pakio_deinit,
-    pakio_exists,
     pakio_open,
     pakio_read,
     pakio_skip,
     pakio_eof,
     pakio_close,
+    pakio_map,
+    pakio_unmap,
+    pakio_scan,
 };
 
 bool pakio_is_archive(const char *path)
@@ -25,6 +25,7 @@
 #include <libs/log.h>
 #include <libs/stb.h>
 
+#include <dirent.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -60,18 +61,70 @@ static void stdio_deinit(void *context)
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "I/O deinitialized");
 }
 
-static bool stdio_exists(const void *context, const char *file)
+// Recursively walks the folder, `path` holds the current sub-folder (relative to the base one) and is extended in-place.
+static void _scan(const char *base_path, char *path, size_t length, File_System_Scan_Callback_t callback, void *user_data)
 {
-    const Std_Context_t *std_context = (const Std_Context_t *)context;
-
     char full_path[FILE_PATH_MAX];
-    strcpy(full_path, std_context->base_path);
-    strcat(full_path, file);
+    strcpy(full_path, base_path);
+    strcat(full_path, path);
+
+    DIR *dp = opendir(full_path);
+    if (!dp) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "can't scan folder `%s`", full_path);
+        return;
+    }
+
+    for (struct dirent *entry = readdir(dp); entry; entry = readdir(dp)) {
+        if (entry->d_name[0] == '.') { // Skip current/parent folders, and hidden entries (e.g. VCS folders).
+            continue;
+        }
+
+        size_t entry_length = strlen(entry->d_name);
+        if (strlen(base_path) + length + entry_length + 1 >= FILE_PATH_MAX) {
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "path for entry `%s` is too long", entry->d_name);
+            continue;
+        }
+        strcpy(path + length, entry->d_name);
+
+        strcpy(full_path, base_path);
+        strcat(full_path, path);
+
+        struct stat statbuf;
+#if PLATFORM_ID == PLATFORM_WINDOWS
+        if (stat(full_path, &statbuf) != 0) {
+            continue;
+        }
+#else
+        if (lstat(full_path, &statbuf) != 0) { // Links aren't followed, as a folder one could lead to a cycle.
+            continue;
+        }
+        if (S_ISLNK(statbuf.st_mode) && (stat(full_path, &statbuf) != 0 || S_ISDIR(statbuf.st_mode))) {
+            Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "skipping linked entry `%s`", full_path);
+            continue;
+        }
+#endif
+        if (S_ISDIR(statbuf.st_mode)) {
+            strcat(path, FILE_SYSTEM_PATH_SEPARATOR_SZ);
+            _scan(base_path, path, length + entry_length + 1, callback, user_data);
+        } else
+        if (S_ISREG(statbuf.st_mode)) {
+            callback(user_data, path, NULL); // The path is all that's needed to access the file.
+        }
+    }
+    path[length] = '\0';
+
+    closedir(dp);
+}
+
+static void stdio_scan(const void *context, File_System_Scan_Callback_t callback, void *user_data)
+{
+    const Std_Context_t *std_context = (const Std_Context_t *)context;
 
-    return access(full_path, R_OK) != -1;
+    char path[FILE_PATH_MAX] = { 0 };
+    _scan(std_context->base_path, path, 0, callback, user_data);
 }
 
-static void *stdio_open(const void *context, const char *file, size_t *size_in_bytes)
+static void *stdio_open(const void *context, const char *file, const void *entry, size_t *size_in_bytes)
 {
     const Std_Context_t *std_context = (const Std_Context_t *)context;
 
@@ -143,10 +196,12 @@ static void stdio_close(void *handle)
 const File_System_Callbacks_t *stdio_callbacks = &(File_System_Callbacks_t){
     stdio_init,
     stdio_deinit,
-    stdio_exists,
     stdio_open,
     stdio_read,
     stdio_skip,
     stdio_eof,
     stdio_close,
+    NULL,
+    NULL,
+    stdio_scan,
 };
@@ -27,9 +27,27 @@
 #include <libs/log.h>
 #include <libs/sincos.h>
 
+#include "deferred.h"
+#include "span.h"
+
 #include <memory.h>
 #include <math.h>
 
+// 16.16 fixed-point arithmetic, used to step the texture coordinates. Conversion to integer truncates toward zero,
+// matching the `(int)` cast of the floating-point counterpart.
+#define FIXED_SHIFT             16
+#define FIXED_ONE               (1 << FIXED_SHIFT)
+
+#define FLOAT_TO_FIXED(f)       ((int32_t)((f) * (float)FIXED_ONE + ((f) < 0.0f ? -0.5f : 0.5f)))
+#define FIXED_TO_INT(x)         ((x) < 0 ? -(-(x) >> FIXED_SHIFT) : (x) >> FIXED_SHIFT)
+#define FIXED_FLOOR(x)          ((x) >> FIXED_SHIFT) // Non-negative values only.
+
+#define FLOAT_TO_FIXED64(f)     ((int64_t)floor((double)(f) * (double)FIXED_ONE + 0.5))
+
+// Maximum amount of pixels processed by the scaled blitter as a single span, per row. Wider regions are
+// processed in (columns) chunks.
+#define SCALED_SPAN_LENGTH      512
+
 #ifdef __DEBUG_GRAPHICS__
 static inline void pixel(const GL_Context_t *context, int x, int y, int index)
 {
@@ -43,11 +61,18 @@ static inline void pixel(const GL_Context_t *context, int x, int y, int index)
 // https://dev.to/fenbf/please-declare-your-variables-as-const
 void GL_context_blit(const GL_Context_t *context, const GL_Surface_t *surface, GL_Rectangle_t area, GL_Point_t position)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_BLIT,
+            .var.blit = { .surface = surface, .area = area, .position = position } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
+#ifdef __GL_MASK_SUPPORT__
     const GL_Pixel_t *shifting = state->shifting;
     const GL_Bool_t *transparent = state->transparent;
-#ifdef __GL_MASK_SUPPORT__
     const GL_Mask_t *mask = &state->mask;
 #endif
 
@@ -82,6 +107,8 @@ void GL_context_blit(const GL_Context_t *context, const GL_Surface_t *surface, G
         return;
     }
 
+    GL_context_dirty(context, &drawing_region);
+
     const GL_Pixel_t *sdata = surface->data;
     GL_Pixel_t *ddata = state->surface->data;
 
@@ -91,10 +118,11 @@ void GL_context_blit(const GL_Context_t *context, const GL_Surface_t *surface, G
     const GL_Pixel_t *sptr = sdata + (area.y + skip_y) * swidth + (area.x + skip_x);
     GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
 
-    const int sskip = swidth - width;
-    const int dskip = dwidth - width;
 #ifdef __GL_MASK_SUPPORT__
     if (mask->stencil) {
+        const int sskip = swidth - width;
+        const int dskip = dwidth - width;
+
         const GL_Surface_t *stencil = mask->stencil;
         const GL_Pixel_t threshold = mask->threshold;
 
@@ -122,35 +150,197 @@ void GL_context_blit(const GL_Context_t *context, const GL_Surface_t *surface, G
     } else {
 #endif
         for (int i = height; i; --i) {
-            for (int j = width; j; --j) {
 #ifdef __DEBUG_GRAPHICS__
+            for (int j = width; j; --j) {
                 pixel(context, drawing_region.x0 + width - j, drawing_region.y0 + height - i, (int)i + (int)j);
-#endif
-                GL_Pixel_t index = shifting[*(sptr++)];
-                if (transparent[index]) {
-                    dptr++;
-                } else {
-                    *(dptr++) = index;
-                }
             }
-            sptr += sskip;
-            dptr += dskip;
+#endif
+            GL_span_blit(dptr, sptr, (size_t)width, state); // Rows are processed with specialized (and SIMD) kernels.
+            sptr += swidth;
+            dptr += dwidth;
         }
 #ifdef __GL_MASK_SUPPORT__
     }
 #endif
 }
 
+// Blits a sheet cell by means of its precompiled opaque runs (see `GL_sheet_compile()`), that are copied
+// span-by-span with no per-pixel transparency test. Clipping is performed on the runs, which need to have been
+// compiled for the current state transparency. When deferred, the runs are recorded along with the cell.
+void GL_context_blit_compiled(const GL_Context_t *context, const GL_Sheet_t *sheet, const GL_Sheet_Runs_t *runs, size_t cell_id, GL_Point_t position)
+{
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_BLIT_COMPILED,
+            .var.compiled = { .sheet = sheet, .runs = runs, .cell_id = cell_id, .position = position } })) {
+        return;
+    }
+#endif
+
+    const GL_State_t *state = &context->state;
+    const GL_Quad_t *clipping_region = &state->clipping_region;
+    const GL_Pixel_t *shifting = state->shifting;
+    const GL_Surface_t *surface = &sheet->atlas;
+    const GL_Rectangle_t area = sheet->cells[cell_id];
+
+#ifdef __GL_MASK_SUPPORT__
+    if (surface->data == state->surface->data || state->mask.stencil) { // Self-blits and masks need the generic path.
+#else
+    if (surface->data == state->surface->data) {
+#endif
+        GL_context_blit(context, surface, area, position);
+        return;
+    }
+
+    GL_Quad_t drawing_region = (GL_Quad_t){
+            .x0 = position.x,
+            .y0 = position.y,
+            .x1 = position.x + area.width - 1,
+            .y1 = position.y + area.height - 1
+        };
+
+    int skip_x = 0; // Offset into the (source) surface/texture, update during clipping.
+    int skip_y = 0;
+
+    if (drawing_region.x0 < clipping_region->x0) {
+        skip_x = clipping_region->x0 - drawing_region.x0;
+        drawing_region.x0 = clipping_region->x0;
+    }
+    if (drawing_region.y0 < clipping_region->y0) {
+        skip_y = clipping_region->y0 - drawing_region.y0;
+        drawing_region.y0 = clipping_region->y0;
+    }
+    if (drawing_region.x1 > clipping_region->x1) {
+        drawing_region.x1 = clipping_region->x1;
+    }
+    if (drawing_region.y1 > clipping_region->y1) {
+        drawing_region.y1 = clipping_region->y1;
+    }
+
+    const int width = drawing_region.x1 - drawing_region.x0 + 1;
+    const int height = drawing_region.y1 - drawing_region.y0 + 1;
+    if ((width <= 0) || (height <= 0)) { // Nothing to draw! Bail out!
+        return;
+    }
+
+    GL_context_dirty(context, &drawing_region);
+
+    const int swidth = surface->width;
+    const int dwidth = state->surface->width;
+
+    const GL_Pixel_t *srow = surface->data + (area.y + skip_y) * swidth + area.x;
+    GL_Pixel_t *drow = state->surface->data + drawing_region.y0 * dwidth + drawing_region.x0;
+
+    const uint16_t *rptr = runs->data + runs->offsets[cell_id];
+    for (int i = skip_y; i; --i) { // Skip the runs of the clipped rows.
+        rptr += 1 + *rptr * 2;
+    }
+
+    const int left = skip_x;
+    const int right = skip_x + width;
+    const bool identity = state->tables_flags & GL_TABLES_IDENTITY;
+
+    for (int i = height; i; --i) {
+        for (int count = *(rptr++); count; --count) {
+            int x0 = *(rptr++);
+            int x1 = x0 + *(rptr++);
+            if (x0 < left) {
+                x0 = left;
+            }
+            if (x1 > right) {
+                x1 = right;
+            }
+            if (x0 >= x1) {
+                continue;
+            }
+
+            const GL_Pixel_t *sptr = srow + x0;
+            GL_Pixel_t *dptr = drow + (x0 - left);
+            if (identity) {
+                memcpy(dptr, sptr, x1 - x0);
+            } else {
+                for (int j = x1 - x0; j; --j) {
+                    *(dptr++) = shifting[*(sptr++)];
+                }
+            }
+        }
+        srow += swidth;
+        drow += dwidth;
+    }
+}
+
+// Restricts the `[*start, *end)` steps range to the ones for which `lo <= p + j * dp < hi`. The result is an
+// approximation, and need to be refined with `span_refine()`.
+static inline void span_interval(float p, float dp, float lo, float hi, int *start, int *end)
+{
+    if (dp == 0.0f) {
+        if (p < lo || p >= hi) {
+            *end = *start;
+        }
+        return;
+    }
+
+    float t0 = (lo - p) / dp;
+    float t1 = (hi - p) / dp;
+    if (t0 > t1) {
+        const float t = t0;
+        t0 = t1;
+        t1 = t;
+    }
+
+    // Clamp to the current range prior conversion, as the values could be very large (e.g. with a tiny `dp`).
+    const int j0 = t0 <= (float)*start ? *start : t0 >= (float)*end ? *end : (int)ceilf(t0);
+    const int j1 = t1 <= (float)*start ? *start : t1 >= (float)*end ? *end : (int)ceilf(t1);
+    *start = j0;
+    *end = j1 > j0 ? j1 : j0;
+}
+
+static inline bool span_inside(int64_t u, int64_t v, const GL_Quad_t *region)
+{
+    return u >= ((int64_t)region->x0 << FIXED_SHIFT) && u < ((int64_t)(region->x1 + 1) << FIXED_SHIFT)
+        && v >= ((int64_t)region->y0 << FIXED_SHIFT) && v < ((int64_t)(region->y1 + 1) << FIXED_SHIFT);
+}
+
+// Since the fixed-point stepping is (exactly) linear the inside steps form a single interval, and checking its
+// endpoints is enough to guarantee that every step is inside the region.
+static inline void span_refine(int64_t u, int64_t v, int32_t du, int32_t dv, const GL_Quad_t *region, int width, int *start, int *end)
+{
+    int j0 = *start;
+    int j1 = *end;
+    while (j0 < j1 && !span_inside(u + j0 * (int64_t)du, v + j0 * (int64_t)dv, region)) {
+        ++j0;
+    }
+    while (j1 > j0 && !span_inside(u + (j1 - 1) * (int64_t)du, v + (j1 - 1) * (int64_t)dv, region)) {
+        --j1;
+    }
+    if (j0 < j1) { // Recover the steps the approximation could have missed at the span borders.
+        while (j0 > 0 && span_inside(u + (j0 - 1) * (int64_t)du, v + (j0 - 1) * (int64_t)dv, region)) {
+            --j0;
+        }
+        while (j1 < width && span_inside(u + j1 * (int64_t)du, v + j1 * (int64_t)dv, region)) {
+            ++j1;
+        }
+    }
+    *start = j0;
+    *end = j1;
+}
+
 // Simple implementation of nearest-neighbour scaling, with x/y flipping according to scaling-factor sign.
 // See `http://tech-algorithm.com/articles/nearest-neighbor-image-scaling/` for a reference code.
 // To avoid empty pixels we scan the destination area and calculate the source pixel.
 void GL_context_blit_s(const GL_Context_t *context, const GL_Surface_t *surface, GL_Rectangle_t area, GL_Point_t position, float scale_x, float scale_y)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_BLIT_S,
+            .var.blit = { .surface = surface, .area = area, .position = position, .scale_x = scale_x, .scale_y = scale_y } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
+#ifdef __GL_MASK_SUPPORT__
     const GL_Pixel_t *shifting = state->shifting;
     const GL_Bool_t *transparent = state->transparent;
-#ifdef __GL_MASK_SUPPORT__
     const GL_Mask_t *mask = &state->mask;
 #endif
 
@@ -164,15 +354,15 @@ void GL_context_blit_s(const GL_Context_t *context, const GL_Surface_t *surface,
             .y1 = position.y + drawing_height - 1,
         };
 
-    float skip_x = 0.0f; // Offset into the (source) surface/texture, update during clipping.
-    float skip_y = 0.0f;
+    int skip_x = 0; // Offset into the (destination) drawing region, update during clipping.
+    int skip_y = 0;
 
     if (drawing_region.x0 < clipping_region->x0) {
-        skip_x = (float)(clipping_region->x0 - drawing_region.x0) / scale_x;
+        skip_x = clipping_region->x0 - drawing_region.x0;
         drawing_region.x0 = clipping_region->x0;
     }
     if (drawing_region.y0 < clipping_region->y0) {
-        skip_y = (float)(clipping_region->y0 - drawing_region.y0) / scale_y;
+        skip_y = clipping_region->y0 - drawing_region.y0;
         drawing_region.y0 = clipping_region->y0;
     }
     if (drawing_region.x1 > clipping_region->x1) {
@@ -188,40 +378,41 @@ void GL_context_blit_s(const GL_Context_t *context, const GL_Surface_t *surface,
         return;
     }
 
+    GL_context_dirty(context, &drawing_region);
+
     const GL_Pixel_t *sdata = surface->data;
     GL_Pixel_t *ddata = state->surface->data;
 
     const int swidth = surface->width;
     const int dwidth = state->surface->width;
 
-    GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
-
-    const size_t dskip = dwidth - width;
-
     const float du = 1.0f / scale_x; // Texture coordinates deltas (signed).
     const float dv = 1.0f / scale_y;
 
-    float ou = (float)area.x + skip_x;
+    float ou = (float)area.x; // Texture coordinates of the (unclipped) origin.
     if (scale_x < 0.0f) {
         ou += (float)area.width + du; // Move to last pixel, scaled, into the texture.
     }
-    float ov = (float)area.y + skip_y;
+    float ov = (float)area.y;
     if (scale_y < 0.0f) {
         ov += (float)area.height + dv;
     }
-    // NOTE: we can also apply an integer-based DDA method, using remainders.
 
 #ifdef __GL_MASK_SUPPORT__
     if (mask->stencil) {
         const GL_Surface_t *stencil = mask->stencil;
         const GL_Pixel_t threshold = mask->threshold;
 
-        float v = ov;
+        GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
+
+        const size_t dskip = dwidth - width;
+
+        float v = ov + (float)skip_y * dv;
         for (int i = height; i; --i) {
             const GL_Pixel_t *sptr = surface->data_rows[(int)v];
             const GL_Pixel_t *mptr = stencil->data_rows[(int)v];
 
-            float u = ou;
+            float u = ou + (float)skip_x * du;
             for (int j = width; j; --j) {
 #ifdef __DEBUG_GRAPHICS__
                 pixel(context, drawing_region.x0 + width - j, drawing_region.y0 + height - i, (int)u + (int)v);
@@ -241,26 +432,42 @@ void GL_context_blit_s(const GL_Context_t *context, const GL_Surface_t *surface,
         }
     } else {
 #endif
-        float v = ov;
-        for (int i = height; i; --i) {
-            const GL_Pixel_t *sptr = sdata + (int)v * swidth;
+        // Fixed-point DDA, the source columns offsets are computed once (for each chunk) and reused by every row.
+        // Each row is gathered into a temporary span and processed by the (specialized) span kernels.
+        // Stepping starts from the unclipped origin, so that the sampled texels don't depend on the clipping region.
+        const int32_t fdu = FLOAT_TO_FIXED(du);
+        const int32_t fdv = FLOAT_TO_FIXED(dv);
+        const int32_t fu = FLOAT_TO_FIXED(ou) + skip_x * fdu;
+        const int32_t fv = FLOAT_TO_FIXED(ov) + skip_y * fdv;
+
+        for (int x = 0; x < width; x += SCALED_SPAN_LENGTH) {
+            const int count = imin(width - x, SCALED_SPAN_LENGTH);
+
+            int offsets[SCALED_SPAN_LENGTH];
+            int32_t u = fu + fdu * x;
+            for (int j = 0; j < count; ++j) {
+                offsets[j] = FIXED_TO_INT(u);
+                u += fdu;
+            }
 
-            float u = ou;
-            for (int j = width; j; --j) {
+            GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0 + x;
+
+            int32_t v = fv;
+            for (int i = 0; i < height; ++i) {
+                const GL_Pixel_t *sptr = sdata + FIXED_TO_INT(v) * swidth;
+
+                GL_Pixel_t span[SCALED_SPAN_LENGTH];
+                for (int j = 0; j < count; ++j) {
 #ifdef __DEBUG_GRAPHICS__
-                pixel(context, drawing_region.x0 + width - j, drawing_region.y0 + height - i, (int)u + (int)v);
+                    pixel(context, drawing_region.x0 + x + j, drawing_region.y0 + i, offsets[j] + FIXED_TO_INT(v));
 #endif
-                GL_Pixel_t index = shifting[sptr[(int)u]];
-                if (transparent[index]) {
-                    dptr++;
-                } else {
-                    *(dptr++) = index;
+                    span[j] = sptr[offsets[j]];
                 }
-                u += du;
-            }
+                GL_span_blit(dptr, span, (size_t)count, state);
 
-            v += dv;
-            dptr += dskip;
+                v += fdv;
+                dptr += dwidth;
+            }
         }
 #ifdef __GL_MASK_SUPPORT__
     }
@@ -271,14 +478,26 @@ void GL_context_blit_s(const GL_Context_t *context, const GL_Surface_t *surface,
 // https://www.flipcode.com/archives/The_Art_of_Demomaking-Issue_10_Roto-Zooming.shtml
 void GL_context_blit_sr(const GL_Context_t *context, const GL_Surface_t *surface, GL_Rectangle_t area, GL_Point_t position, float scale_x, float scale_y, int rotation, float anchor_x, float anchor_y)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_BLIT_SR,
+            .var.blit = { .surface = surface, .area = area, .position = position, .scale_x = scale_x, .scale_y = scale_y,
+                .rotation = rotation, .anchor_x = anchor_x, .anchor_y = anchor_y } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
+#ifdef __GL_MASK_SUPPORT__
     const GL_Pixel_t *shifting = state->shifting;
     const GL_Bool_t *transparent = state->transparent;
-#ifdef __GL_MASK_SUPPORT__
     const GL_Mask_t *mask = &state->mask;
 #endif
 
+    if (scale_x == 0.0f || scale_y == 0.0f) { // Degenerate (and non-invertible) transformation, nothing to draw.
+        return;
+    }
+
     const float w = (float)area.width;
     const float h = (float)area.height;
     const float sw = w * scale_x;
@@ -358,6 +577,8 @@ void GL_context_blit_sr(const GL_Context_t *context, const GL_Surface_t *surface
         return;
     }
 
+    GL_context_dirty(context, &drawing_region);
+
     const int sminx = area.x;
     const int sminy = area.y;
     const int smaxx = area.x + area.width - 1;
@@ -368,26 +589,26 @@ void GL_context_blit_sr(const GL_Context_t *context, const GL_Surface_t *surface
     const float M21 = -s / scale_y; // |           | |      |
     const float M22 = c / scale_y;  // |    0 1/sy | | -s c |
 
-    const float tlx = (float)drawing_region.x0 - dx; // Transform the top-left corner of the to-be-drawn rectangle to texture space.
-    const float tly = (float)drawing_region.y0 - dy; // (could differ from AABB x0 due to clipping, we need to compute it again)
-    float ou = (tlx * M11 + tly * M12) + sax + sx; // Offset to the source texture quad.
-    float ov = (tlx * M21 + tly * M22) + say + sy;
-
     const GL_Pixel_t *sdata = surface->data;
     GL_Pixel_t *ddata = state->surface->data;
 
     const int swidth = surface->width;
     const int dwidth = state->surface->width;
 
-    GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
-
-    const int dskip = dwidth - width;
-
 #ifdef __GL_MASK_SUPPORT__
     if (mask->stencil) {
         const GL_Surface_t *stencil = mask->stencil;
         const GL_Pixel_t threshold = mask->threshold;
 
+        const float tlx = (float)drawing_region.x0 - dx; // Transform the top-left corner of the to-be-drawn rectangle to texture space.
+        const float tly = (float)drawing_region.y0 - dy; // (could differ from AABB x0 due to clipping, we need to compute it again)
+        float ou = (tlx * M11 + tly * M12) + sax + sx; // Offset to the source texture quad.
+        float ov = (tlx * M21 + tly * M22) + say + sy;
+
+        GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
+
+        const int dskip = dwidth - width;
+
         for (int i = height; i; --i) {
             float u = ou;
             float v = ov;
@@ -425,38 +646,52 @@ void GL_context_blit_sr(const GL_Context_t *context, const GL_Surface_t *surface
         }
     } else {
 #endif
-        for (int i = height; i; --i) {
-            float u = ou;
-            float v = ov;
-
-            for (int j = width; j; --j) {
-#ifdef __DEBUG_GRAPHICS__
-                pixel(context, drawing_region.x0 + width - j, drawing_region.y0 + height - i, 15);
-#endif
-                int x = (int)floorf(u); // Round down, to preserve negative values as such (e.g. `-0.3` is `-1`) and avoid mirror effect.
-                int y = (int)floorf(v);
-
-                if (x >= sminx && x <= smaxx && y >= sminy && y <= smaxy) {
+        // For each scan-line we compute (analytically) the span of pixels whose inverse-mapped texture coordinates
+        // fall inside the source area. The span is then walked with no bounds checks, in fixed-point.
+        const GL_Quad_t source_region = (GL_Quad_t){ .x0 = sminx, .y0 = sminy, .x1 = smaxx, .y1 = smaxy };
+
+        // The texture coordinates are computed in fixed-point from the (unclipped) destination position, so that
+        // the sampled texels don't depend on the clipping region.
+        const int32_t fdu = FLOAT_TO_FIXED(M11);
+        const int32_t fdv = FLOAT_TO_FIXED(M21);
+        const int32_t fdu_row = FLOAT_TO_FIXED(M12);
+        const int32_t fdv_row = FLOAT_TO_FIXED(M22);
+        const int64_t fou = FLOAT_TO_FIXED64(sax + sx) + (int64_t)(drawing_region.x0 - position.x) * fdu + (int64_t)(drawing_region.y0 - position.y) * fdu_row;
+        const int64_t fov = FLOAT_TO_FIXED64(say + sy) + (int64_t)(drawing_region.x0 - position.x) * fdv + (int64_t)(drawing_region.y0 - position.y) * fdv_row;
+
+        GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
+
+        for (int i = 0; i < height; ++i) {
 #ifdef __DEBUG_GRAPHICS__
-                    pixel(context, drawing_region.x0 + width - j, drawing_region.y0 + height - i, i + j);
+            for (int j = 0; j < width; ++j) {
+                pixel(context, drawing_region.x0 + j, drawing_region.y0 + i, 15);
+            }
 #endif
-                    const GL_Pixel_t *sptr = sdata + y * swidth + x;
-                    GL_Pixel_t index = shifting[*sptr];
-                    if (!transparent[index]) {
-                        *dptr = index;
-                    }
+            const int64_t fu = fou + (int64_t)i * fdu_row;
+            const int64_t fv = fov + (int64_t)i * fdv_row;
+
+            int start = 0, end = width;
+            span_interval((float)fu / (float)FIXED_ONE, M11, (float)sminx, (float)(smaxx + 1), &start, &end);
+            span_interval((float)fv / (float)FIXED_ONE, M21, (float)sminy, (float)(smaxy + 1), &start, &end);
+
+            // Refine the span on the actual fixed-point values, to be sure no out-of-bounds access can occur.
+            span_refine(fu, fv, fdu, fdv, &source_region, width, &start, &end);
+
+            int32_t su = (int32_t)(fu + (int64_t)start * fdu);
+            int32_t sv = (int32_t)(fv + (int64_t)start * fdv);
+            for (int x = start; x < end; x += SCALED_SPAN_LENGTH) {
+                const int count = imin(end - x, SCALED_SPAN_LENGTH);
+
+                GL_Pixel_t span[SCALED_SPAN_LENGTH];
+                for (int j = 0; j < count; ++j) {
+                    span[j] = sdata[FIXED_FLOOR(sv) * swidth + FIXED_FLOOR(su)];
+                    su += fdu;
+                    sv += fdv;
                 }
-
-                ++dptr;
-
-                u += M11;
-                v += M21;
+                GL_span_blit(dptr + x, span, (size_t)count, state);
             }
 
-            dptr += dskip;
-
-            ou += M12;
-            ov += M22;
+            dptr += dwidth;
         }
 #ifdef __GL_MASK_SUPPORT__
     }
@@ -469,19 +704,113 @@ void GL_context_blit_sr(const GL_Context_t *context, const GL_Surface_t *surface
 #endif
 }
 
+static inline int64_t fixed_mod(int64_t a, int64_t b)
+{
+    return ((a % b) + b) % b;
+}
+
+// Each of the following samples a scan-line span of `count` texels, starting from the `u/v` fixed-point coordinates
+// and stepping by `du/dv`, with a specific wrapping mode. This way the mode is checked once per span rather than once
+// per pixel.
+
+// With power-of-two sizes the wrapping is a bit-mask. Unsigned arithmetic is used on purpose, since overflowing
+// preserves the lower bits (i.e. the ones we need).
+static inline void xform_repeat_pow2(GL_Pixel_t *span, int count, int64_t u, int64_t v, int64_t du, int64_t dv, const GL_Surface_t *surface)
+{
+    const GL_Pixel_t *sdata = surface->data;
+    const size_t swidth = surface->width;
+    const uint32_t umask = (uint32_t)surface->width - 1;
+    const uint32_t vmask = (uint32_t)surface->height - 1;
+
+    uint32_t su = (uint32_t)u;
+    uint32_t sv = (uint32_t)v;
+    const uint32_t sdu = (uint32_t)du;
+    const uint32_t sdv = (uint32_t)dv;
+    for (int j = 0; j < count; ++j) {
+        span[j] = sdata[((sv >> FIXED_SHIFT) & vmask) * swidth + ((su >> FIXED_SHIFT) & umask)];
+        su += sdu;
+        sv += sdv;
+    }
+}
+
+// Coordinates (and steps) are wrapped in the `[0, size)` range once, then kept there with a single subtraction.
+static inline void xform_repeat(GL_Pixel_t *span, int count, int64_t u, int64_t v, int64_t du, int64_t dv, const GL_Surface_t *surface)
+{
+    const GL_Pixel_t *sdata = surface->data;
+    const size_t swidth = surface->width;
+    const int64_t ulimit = (int64_t)surface->width << FIXED_SHIFT;
+    const int64_t vlimit = (int64_t)surface->height << FIXED_SHIFT;
+
+    uint32_t su = (uint32_t)fixed_mod(u, ulimit);
+    uint32_t sv = (uint32_t)fixed_mod(v, vlimit);
+    const uint32_t sdu = (uint32_t)fixed_mod(du, ulimit);
+    const uint32_t sdv = (uint32_t)fixed_mod(dv, vlimit);
+    for (int j = 0; j < count; ++j) {
+        span[j] = sdata[(sv >> FIXED_SHIFT) * swidth + (su >> FIXED_SHIFT)];
+        su += sdu;
+        if (su >= (uint32_t)ulimit) {
+            su -= (uint32_t)ulimit;
+        }
+        sv += sdv;
+        if (sv >= (uint32_t)vlimit) {
+            sv -= (uint32_t)vlimit;
+        }
+    }
+}
+
+static inline void xform_edge(GL_Pixel_t *span, int count, int64_t u, int64_t v, int64_t du, int64_t dv, const GL_Surface_t *surface)
+{
+    const GL_Pixel_t *sdata = surface->data;
+    const size_t swidth = surface->width;
+    const int64_t ulimit = (int64_t)surface->width << FIXED_SHIFT;
+    const int64_t vlimit = (int64_t)surface->height << FIXED_SHIFT;
+    const size_t smaxx = surface->width - 1;
+    const size_t smaxy = surface->height - 1;
+
+    for (int j = 0; j < count; ++j) {
+        const size_t x = u < 0 ? 0 : u >= ulimit ? smaxx : (size_t)(u >> FIXED_SHIFT);
+        const size_t y = v < 0 ? 0 : v >= vlimit ? smaxy : (size_t)(v >> FIXED_SHIFT);
+        span[j] = sdata[y * swidth + x];
+        u += du;
+        v += dv;
+    }
+}
+
+// The span has already been restricted to the steps falling inside the surface, so no check is required.
+static inline void xform_border(GL_Pixel_t *span, int count, int64_t u, int64_t v, int64_t du, int64_t dv, const GL_Surface_t *surface)
+{
+    const GL_Pixel_t *sdata = surface->data;
+    const size_t swidth = surface->width;
+
+    int32_t su = (int32_t)u;
+    int32_t sv = (int32_t)v;
+    const int32_t sdu = (int32_t)du;
+    const int32_t sdv = (int32_t)dv;
+    for (int j = 0; j < count; ++j) {
+        span[j] = sdata[FIXED_FLOOR(sv) * swidth + FIXED_FLOOR(su)];
+        su += sdu;
+        sv += sdv;
+    }
+}
+
 // https://www.youtube.com/watch?v=3FVN_Ze7bzw
 // http://www.coranac.com/tonc/text/mode7.htm
 // https://wiki.superfamicom.org/registers
 // https://www.smwcentral.net/?p=viewthread&t=27054
 void GL_context_blit_x(const GL_Context_t *context, const GL_Surface_t *surface, GL_Point_t position, const GL_XForm_t *xform)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_BLIT_X,
+            .var.xform = { .surface = surface, .position = position, .xform = *xform } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
-    const GL_Pixel_t *shifting = state->shifting;
-    const GL_Bool_t *transparent = state->transparent;
 
     const int clamp = xform->clamp;
-    const GL_XForm_Table_Entry_t *table = xform->table;
+    const GL_XForm_Scan_Line_t *table = xform->table;
 
     GL_Quad_t drawing_region = (GL_Quad_t) {
         .x0 = position.x,
@@ -509,23 +838,19 @@ void GL_context_blit_x(const GL_Context_t *context, const GL_Surface_t *surface,
         return;
     }
 
+    GL_context_dirty(context, &drawing_region);
+
     const int sw = surface->width;
     const int sh = surface->height;
-    const int sminx = 0;
-    const int sminy = 0;
-    const int smaxx = sw - 1;
-    const int smaxy = sh - 1;
+    const GL_Quad_t source_region = (GL_Quad_t){ .x0 = 0, .y0 = 0, .x1 = sw - 1, .y1 = sh - 1 };
+    const bool pow2 = (sw & (sw - 1)) == 0 && (sh & (sh - 1)) == 0; // Power-of-two sizes wrap with a mask.
 
-    const GL_Pixel_t *sdata = surface->data;
     GL_Pixel_t *ddata = state->surface->data;
 
-    const int swidth = surface->width;
     const int dwidth = state->surface->width;
 
     GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
 
-    const int dskip = dwidth - width;
-
     // The basic Mode7 formula is the following
     //
     // [ X ]   [ A B ]   [ SX + H - CX ]   [ CX ]
@@ -550,88 +875,77 @@ void GL_context_blit_x(const GL_Context_t *context, const GL_Surface_t *surface,
     //
     // X = A * (SX - CX) + B * (SY - CY) + CX + H
     // Y = C * (SX - CX) + D * (SY - CY) + CY + V
-    const float *registers = xform->registers;
-    float h = registers[GL_XFORM_REGISTER_H]; float v = registers[GL_XFORM_REGISTER_V];
-    float a = registers[GL_XFORM_REGISTER_A]; float b = registers[GL_XFORM_REGISTER_B];
-    float c = registers[GL_XFORM_REGISTER_C]; float d = registers[GL_XFORM_REGISTER_D];
-    float x0 = registers[GL_XFORM_REGISTER_X]; float y0 = registers[GL_XFORM_REGISTER_Y];
+    //
+    // The scan-line start is computed in floating-point, then the span is walked in 16.16 fixed-point.
+    //
+    // When present, the (compiled) table overrides the registers on each scan-line.
+    float registers[GL_XForm_Registers_t_CountOf];
+    memcpy(registers, xform->registers, sizeof(registers));
+
+    const size_t scan_lines = table ? xform->scan_lines : 0;
 
     for (int i = 0; i < height; ++i) {
-        if (table && i == table->scan_line) {
-            for (size_t k = 0; k < table->count; ++k) {
-                const GL_XForm_Registers_t id = table->operations[k].id;
-                const float value = table->operations[k].value;
-                switch (id) {
-                    case GL_XFORM_REGISTER_H: { h = value; } break;
-                    case GL_XFORM_REGISTER_V: { v = value; } break;
-                    case GL_XFORM_REGISTER_A: { a = value; } break;
-                    case GL_XFORM_REGISTER_B: { b = value; } break;
-                    case GL_XFORM_REGISTER_C: { c = value; } break;
-                    case GL_XFORM_REGISTER_D: { d = value; } break;
-                    case GL_XFORM_REGISTER_X: { x0 = value; } break;
-                    case GL_XFORM_REGISTER_Y: { y0 = value; } break;
-                    default: { ; } break;
-                }
+        if (scan_lines > 0) {
+            const GL_XForm_Scan_Line_t *scan_line = &table[(size_t)i < scan_lines ? (size_t)i : scan_lines - 1];
+            for (int id = GL_XForm_Registers_t_First; id < GL_XForm_Registers_t_CountOf; ++id) {
+                registers[id] = (scan_line->mask & (1u << id)) ? scan_line->registers[id] : xform->registers[id];
             }
-            ++table;
-#ifdef __DETACH_XFORM_TABLE__
-            if (table->scan_line == -1) { // End-of-data reached, detach pointer for faster loop.
-                table = NULL;
-            }
-#endif
         }
 
+        const float h = registers[GL_XFORM_REGISTER_H]; const float v = registers[GL_XFORM_REGISTER_V];
+        const float a = registers[GL_XFORM_REGISTER_A]; const float b = registers[GL_XFORM_REGISTER_B];
+        const float c = registers[GL_XFORM_REGISTER_C]; const float d = registers[GL_XFORM_REGISTER_D];
+        const float x0 = registers[GL_XFORM_REGISTER_X]; const float y0 = registers[GL_XFORM_REGISTER_Y];
+
+#ifdef __DEBUG_GRAPHICS__
+        for (int j = 0; j < width; ++j) {
+            pixel(context, drawing_region.x0 + j, drawing_region.y0 + i, i + j);
+        }
+#endif
         const float xi = 0.0f - x0;
         const float yi = (float)i - y0;
 
 #ifndef __CLIP_OFFSET__
-        float xp = (a * xi + b * yi) + x0 + h;
-        float yp = (c * xi + d * yi) + y0 + v;
+        const float xp = (a * xi + b * yi) + x0 + h;
+        const float yp = (c * xi + d * yi) + y0 + v;
 #else
-        float xp = (a * xi + b * yi) + x0 + fmodf(h, sw); // Clip to avoid cancellation when H/V are large.
-        float yp = (c * xi + d * yi) + y0 + fmodf(v, sh);
+        const float xp = (a * xi + b * yi) + x0 + fmodf(h, sw); // Clip to avoid cancellation when H/V are large.
+        const float yp = (c * xi + d * yi) + y0 + fmodf(v, sh);
 #endif
 
-        for (int j = 0; j < width; ++j) {
-#ifdef __DEBUG_GRAPHICS__
-            pixel(context, drawing_region.x0 + j, drawing_region.y0 + i, i + j);
-#endif
-            int sx = (int)(xp + 0.5f); // Round to avoid artifacts.
-            int sy = (int)(yp + 0.5f);
+        const int64_t fu = FLOAT_TO_FIXED64(xp + 0.5f); // Round to the nearest texel, to avoid artifacts.
+        const int64_t fv = FLOAT_TO_FIXED64(yp + 0.5f);
+        const int64_t fdu = FLOAT_TO_FIXED64(a);
+        const int64_t fdv = FLOAT_TO_FIXED64(c);
+
+        int start = 0, end = width;
+        if (clamp == GL_XFORM_CLAMP_BORDER) { // Only the pixels sampling the surface are drawn.
+            span_interval((float)fu / (float)FIXED_ONE, a, 0.0f, (float)sw, &start, &end);
+            span_interval((float)fv / (float)FIXED_ONE, c, 0.0f, (float)sh, &start, &end);
+            span_refine(fu, fv, (int32_t)fdu, (int32_t)fdv, &source_region, width, &start, &end);
+        }
+
+        for (int x = start; x < end; x += SCALED_SPAN_LENGTH) {
+            const int count = imin(end - x, SCALED_SPAN_LENGTH);
+            const int64_t u = fu + (int64_t)x * fdu;
+            const int64_t v = fv + (int64_t)x * fdv;
 
+            GL_Pixel_t span[SCALED_SPAN_LENGTH];
             if (clamp == GL_XFORM_CLAMP_REPEAT) {
-                sx = imod(sx, sw);
-                sy = imod(sy, sh);
+                if (pow2) {
+                    xform_repeat_pow2(span, count, u, v, fdu, fdv, surface);
+                } else {
+                    xform_repeat(span, count, u, v, fdu, fdv, surface);
+                }
             } else
             if (clamp == GL_XFORM_CLAMP_EDGE) {
-                if (sx < sminx) {
-                    sx = sminx;
-                } else
-                if (sx > smaxx) {
-                    sx = smaxx;
-                }
-                if (sy < sminy) {
-                    sy = sminy;
-                } else
-                if (sy > smaxy) {
-                    sy = smaxy;
-                }
+                xform_edge(span, count, u, v, fdu, fdv, surface);
+            } else {
+                xform_border(span, count, u, v, fdu, fdv, surface);
             }
-
-            if (sx >= sminx && sx <= smaxx && sy >= sminy && sy <= smaxy) {
-                const GL_Pixel_t *sptr = sdata + sy * swidth + sx;
-                GL_Pixel_t index = shifting[*sptr];
-                if (!transparent[index]) {
-                    *dptr = index;
-                }
-            }
-
-            ++dptr;
-
-            xp += a;
-            yp += c;
+            GL_span_blit(dptr + x, span, (size_t)count, state);
         }
 
-        dptr += dskip;
+        dptr += dwidth;
     }
 }
@@ -25,10 +25,12 @@
 
 #include "common.h"
 #include "context.h"
+#include "sheet.h"
 #include "surface.h"
 #include "xform.h"
 
 extern void GL_context_blit(const GL_Context_t *context, const GL_Surface_t *surface, GL_Rectangle_t area, GL_Point_t position);
+extern void GL_context_blit_compiled(const GL_Context_t *context, const GL_Sheet_t *sheet, const GL_Sheet_Runs_t *runs, size_t cell_id, GL_Point_t position);
 extern void GL_context_blit_s(const GL_Context_t *context, const GL_Surface_t *surface, GL_Rectangle_t area, GL_Point_t position, float sx, float sy);
 extern void GL_context_blit_sr(const GL_Context_t *context, const GL_Surface_t *surface, GL_Rectangle_t area, GL_Point_t position, float sx, float sy, int rotation, float ax, float ay);
 extern void GL_context_blit_x(const GL_Context_t *context, const GL_Surface_t *surface, GL_Point_t position, const GL_XForm_t *xform);
@@ -36,6 +36,11 @@ typedef struct _GL_Point_t {
     int x, y;
 } GL_Point_t;
 
+typedef struct _GL_Vertex_t {
+    int x, y;
+    float u, v; // Texture coordinates, in source surface pixels.
+} GL_Vertex_t;
+
 typedef struct _GL_Size_t {
     size_t width, height;
 } GL_Size_t;
@@ -52,7 +57,9 @@ typedef struct _GL_Quad_t {
 
 typedef struct _GL_Image_t {
     size_t width, height;
-    const void *data;
+    const void *data; // RGBA quadruplets, or palette indexes when `colors` is non-zero.
+    const void *palette; // RGBA quadruplets.
+    size_t colors;
 } GL_Image_t;
 
 #pragma pack(push, 1)
@@ -25,14 +25,99 @@
 #include <config.h>
 #include <libs/imath.h>
 #include <libs/log.h>
-#include <libs/stb.h>
 
+#include "deferred.h"
+#include "span.h"
 #include "surface.h"
 
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define LOG_CONTEXT "gl"
 
-static inline void reset_state(GL_State_t *state, GL_Surface_t *surface)
+#define DEFAULT_TABLES_ID   0
+
+#define PARALLEL_RGBA_THRESHOLD (64 * 1024) // Below this amount of pixels, waking up the workers isn't worth it.
+
+#define EMPTY_REGION        (GL_Quad_t){ .x0 = INT_MAX, .y0 = INT_MAX, .x1 = INT_MIN, .y1 = INT_MIN }
+
+static inline void merge(GL_Quad_t *region, const GL_Quad_t *other)
+{
+    region->x0 = imin(region->x0, other->x0);
+    region->y0 = imin(region->y0, other->y0);
+    region->x1 = imax(region->x1, other->x1);
+    region->y1 = imax(region->y1, other->y1);
+}
+
+static uint32_t _tables_id = DEFAULT_TABLES_ID; // Global, so that ids are unique across contexts and stacked states.
+
+static void update_tables(GL_State_t *state, uint32_t id)
 {
+    int flags = GL_TABLES_IDENTITY | GL_TABLES_OPAQUE;
+    size_t transparent_count = 0;
+    GL_Transparency_t transparency = { 0 };
+    for (size_t i = 0; i < GL_MAX_PALETTE_COLORS; ++i) {
+        if (state->shifting[i] != (GL_Pixel_t)i) {
+            flags &= ~GL_TABLES_IDENTITY;
+        }
+        if (state->transparent[i]) {
+            state->transparent_key = (GL_Pixel_t)i;
+            transparent_count += 1;
+        }
+        if (state->transparent[state->shifting[i]]) {
+            transparency.bits[i / 32] |= (uint32_t)1 << (i % 32);
+        }
+    }
+    if (transparent_count > 0) {
+        flags &= ~GL_TABLES_OPAQUE;
+    }
+    if (transparent_count == 1) {
+        flags |= GL_TABLES_SINGLE_TRANSPARENT;
+    }
+
+    state->tables_id = id;
+    state->tables_flags = flags;
+    state->transparency = transparency;
+}
+
+static inline void bind_tables(GL_State_t *state, GL_Tables_t *tables)
+{
+    state->tables = tables;
+    state->shifting = tables->shifting;
+    state->transparent = tables->transparent;
+}
+
+// Get the current state tables, ready to be modified. When shared, they are copied into a free slot of the arena.
+// There's always one, since at most `depth + 1` slots are referenced, and two of them are the same.
+static GL_Tables_t *writable_tables(GL_Context_t *context)
+{
+    GL_State_t *state = &context->state;
+    GL_Tables_t *tables = state->tables;
+    if (tables->references == 1) {
+        return tables;
+    }
+
+    GL_Tables_t *copy = context->tables;
+    while (copy->references > 0) {
+        ++copy;
+    }
+    memcpy(copy->shifting, tables->shifting, sizeof(copy->shifting));
+    memcpy(copy->transparent, tables->transparent, sizeof(copy->transparent));
+    copy->references = 1;
+
+    tables->references -= 1;
+    bind_tables(state, copy);
+
+    return copy;
+}
+
+static void reset_state(GL_Context_t *context)
+{
+    GL_State_t *state = &context->state;
+    GL_Surface_t *surface = &context->buffer;
+    GL_Tables_t *tables = state->tables; // Retain the current ones, they are reset below.
+
     *state = (GL_State_t){
             .surface = surface,
             .clipping_region = (GL_Quad_t){ .x0 = 0, .y0 = 0, .x1 = surface->width - 1, .y1 = surface->height - 1 },
@@ -42,20 +127,55 @@ static inline void reset_state(GL_State_t *state, GL_Surface_t *surface)
             .threshold = 0
 #endif
         };
+    bind_tables(state, tables);
+
+    tables = writable_tables(context);
     for (size_t i = 0; i < GL_MAX_PALETTE_COLORS; ++i) {
-        state->shifting[i] = i;
-        state->transparent[i] = GL_BOOL_FALSE;
+        tables->shifting[i] = i;
+        tables->transparent[i] = GL_BOOL_FALSE;
     }
-    state->transparent[0] = GL_BOOL_TRUE;
+    tables->transparent[0] = GL_BOOL_TRUE;
+    update_tables(state, DEFAULT_TABLES_ID);
 }
 
 bool GL_context_create(GL_Context_t *context, size_t width, size_t height)
 {
     *context = (GL_Context_t){ 0 };
 
+    GL_span_initialize();
+
     GL_surface_create(&context->buffer, width, height);
 
-    reset_state(&context->state, &context->buffer);
+    context->dirty = malloc(sizeof(GL_Dirty_t));
+    if (!context->dirty) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate dirty region");
+        GL_surface_delete(&context->buffer);
+        return false;
+    }
+    *context->dirty = (GL_Dirty_t){ // The whole buffer is initially dirty, as it has never been presented.
+            .surface = &context->buffer,
+            .region = (GL_Quad_t){ .x0 = 0, .y0 = 0, .x1 = (int)width - 1, .y1 = (int)height - 1 },
+            .extents = EMPTY_REGION,
+            .cleared = false
+        };
+
+    context->stack = malloc(GL_CONTEXT_STACK_CAPACITY * sizeof(GL_State_t));
+    context->tables = malloc(GL_CONTEXT_TABLES_CAPACITY * sizeof(GL_Tables_t));
+    if (!context->stack || !context->tables) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate states stack");
+        free(context->tables);
+        free(context->stack);
+        free(context->dirty);
+        GL_surface_delete(&context->buffer);
+        return false;
+    }
+    for (size_t i = 0; i < GL_CONTEXT_TABLES_CAPACITY; ++i) {
+        context->tables[i].references = 0;
+    }
+    context->tables[0].references = 1;
+    context->state.tables = &context->tables[0];
+
+    reset_state(context);
 
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context created");
     return true;
@@ -63,47 +183,105 @@ bool GL_context_create(GL_Context_t *context, size_t width, size_t height)
 
 void GL_context_delete(GL_Context_t *context)
 {
-    arrfree(context->stack);
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred) {
+        GL_deferred_delete(context->deferred);
+        free(context->deferred);
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context deferred storage deallocated");
+    }
+#endif
+
+    free(context->stack);
+    free(context->tables);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context stack deallocated");
 
+    free(context->dirty);
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context dirty region deallocated");
+
     GL_surface_delete(&context->buffer);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context buffer deallocated");
 
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context deleted");
 }
 
-void GL_context_push(GL_Context_t *context)
+#ifdef __GL_DEFERRED_SUPPORT__
+bool GL_context_defer(GL_Context_t *context, size_t workers)
+{
+    GL_Deferred_t *deferred = malloc(sizeof(GL_Deferred_t));
+    if (!deferred) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate deferred storage");
+        return false;
+    }
+
+    if (!GL_deferred_create(deferred, &context->buffer, context->dirty, workers)) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't create deferred storage");
+        free(deferred);
+        return false;
+    }
+
+    context->deferred = deferred;
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context deferred w/ %d worker(s)", workers);
+    return true;
+}
+#endif
+
+void GL_context_flush(const GL_Context_t *context)
+{
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred) {
+        GL_deferred_flush(context->deferred);
+    }
+#endif
+}
+
+// The pushed state shares the tables with the current one, until either is modified.
+bool GL_context_push(GL_Context_t *context)
 {
-    arrpush(context->stack, context->state); // Store current state into stack.
+    if (context->depth == GL_CONTEXT_STACK_CAPACITY) {
+        Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "too many states pushed into context");
+        return false;
+    }
+    context->stack[context->depth++] = context->state; // Store current state into stack.
+    context->state.tables->references += 1;
+    return true;
 }
 
 void GL_context_pop(GL_Context_t *context)
 {
-    if (arrlen(context->stack) < 1) {
+    if (context->depth == 0) {
         Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "no states to pop from context");
         return;
     }
-    context->state = arrpop(context->stack);
+    context->state.tables->references -= 1;
+    context->state = context->stack[--context->depth];
 }
 
 void GL_context_reset(GL_Context_t *context)
 {
-    arrfree(context->stack);
-    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context stack deallocated");
+    for (size_t i = 0; i < context->depth; ++i) {
+        context->stack[i].tables->references -= 1;
+    }
+    context->depth = 0;
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context stack emptied");
 
-    reset_state(&context->state, &context->buffer);
+    reset_state(context);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "context reset");
 }
 
 void GL_context_sanitize(GL_Context_t *context, const GL_Surface_t *surface)
 {
-    for (int i = arrlen(context->stack) - 1; i >= 0; --i) {
+    GL_context_flush(context); // Pending commands could still refer to the surface.
+
+    for (int i = (int)context->depth - 1; i >= 0; --i) {
 #ifdef __GL_MASK_SUPPORT__
         if (context->stack[i].surface == surface || context->stack[i].mask.stencil == surface) {
 #else
         if (context->stack[i].surface == surface) {
 #endif
-            arrdel(context->stack, i);
+            context->stack[i].tables->references -= 1;
+            memmove(context->stack + i, context->stack + i + 1, (context->depth - i - 1) * sizeof(GL_State_t));
+            context->depth -= 1;
             Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "state #%d sanitized from context", i);
         }
     }
@@ -121,30 +299,34 @@ void GL_context_surface(GL_Context_t *context, GL_Surface_t *surface)
 void GL_context_shifting(GL_Context_t *context, const size_t *from, const size_t *to, size_t count)
 {
     GL_State_t *state = &context->state;
+    GL_Tables_t *tables = writable_tables(context);
     if (!from) {
         for (size_t i = 0; i < GL_MAX_PALETTE_COLORS; ++i) {
-            state->shifting[i] = i;
+            tables->shifting[i] = i;
         }
     } else {
         for (size_t i = 0; i < count; ++i) {
-            state->shifting[from[i]] = to[i];
+            tables->shifting[from[i]] = to[i];
         }
     }
+    update_tables(state, ++_tables_id);
 }
 
 void GL_context_transparent(GL_Context_t *context, const GL_Pixel_t *indexes, const GL_Bool_t *transparent, size_t count)
 {
     GL_State_t *state = &context->state;
+    GL_Tables_t *tables = writable_tables(context);
     if (!indexes) {
         for (size_t i = 0; i < GL_MAX_PALETTE_COLORS; ++i) {
-            state->transparent[i] = GL_BOOL_FALSE;
+            tables->transparent[i] = GL_BOOL_FALSE;
         }
-        state->transparent[0] = GL_BOOL_TRUE;
+        tables->transparent[0] = GL_BOOL_TRUE;
     } else {
         for (size_t i = 0; i < count; ++i) {
-            state->transparent[indexes[i]] = transparent[i];
+            tables->transparent[indexes[i]] = transparent[i];
         }
     }
+    update_tables(state, ++_tables_id);
 }
 
 void GL_context_clipping(GL_Context_t *context, const GL_Rectangle_t *region)
@@ -197,18 +379,108 @@ void GL_context_mask(GL_Context_t *context, const GL_Mask_t *mask)
 }
 #endif
 
+// The region is clipped against the current clipping region, so that callers can pass the unclipped bounds of
+// what they are going to draw. Only drawing on the tracked surface is taken into account. A `NULL` region marks
+// the whole tracked surface, regardless of the current one and of the clipping region, as needing to be presented
+// again with no pixel being changed (e.g. on palette change).
+void GL_context_dirty(const GL_Context_t *context, const GL_Quad_t *region)
+{
+    GL_Dirty_t *dirty = context->dirty;
+    if (!dirty) {
+        return;
+    }
+
+    if (!region) {
+        const GL_Surface_t *surface = dirty->surface;
+        dirty->region = (GL_Quad_t){ .x0 = 0, .y0 = 0, .x1 = (int)surface->width - 1, .y1 = (int)surface->height - 1 };
+        return;
+    }
+
+    const GL_State_t *state = &context->state;
+    if (state->surface != dirty->surface) {
+        return;
+    }
+
+    const GL_Quad_t *clipping_region = &state->clipping_region;
+    const int x0 = imax(region->x0, clipping_region->x0);
+    const int y0 = imax(region->y0, clipping_region->y0);
+    const int x1 = imin(region->x1, clipping_region->x1);
+    const int y1 = imin(region->y1, clipping_region->y1);
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+
+    const GL_Quad_t drawn = (GL_Quad_t){ .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1 };
+    merge(&dirty->region, &drawn);
+    merge(&dirty->extents, &drawn);
+}
+
+// Retrieve (and reset) the dirty region. Returns `false` when nothing has been drawn since the last call.
+bool GL_context_collect_dirty(const GL_Context_t *context, GL_Quad_t *region)
+{
+    GL_context_flush(context);
+
+    GL_Dirty_t *dirty = context->dirty;
+    *region = dirty->region;
+    dirty->region = EMPTY_REGION;
+    return region->x0 <= region->x1;
+}
+
+// Convert the buffer rows to RGBA (the pending commands are completed first). When deferred, large conversions are
+// split among the workers, each one taking care of its own band.
+void GL_context_to_rgba_rows(const GL_Context_t *context, const GL_Palette_t *palette, GL_Color_t *vram, size_t first, size_t count)
+{
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && count * context->buffer.width >= PARALLEL_RGBA_THRESHOLD) {
+        GL_deferred_to_rgba_rows(context->deferred, &context->buffer, palette, vram, first, count);
+        return;
+    }
+#endif
+    GL_context_flush(context);
+
+    GL_surface_to_rgba_rows(&context->buffer, palette, vram, first, count);
+}
+
+// When clearing the buffer with the same background as the last time, only the extents of what has been drawn in
+// the meanwhile need to be cleared (pending deferred commands are executed first, to know them).
 void GL_context_clear(const GL_Context_t *context)
 {
     const GL_State_t *state = &context->state;
-    const GL_Pixel_t color = state->background;
-    GL_Pixel_t *dst = state->surface->data;
-    for (size_t i = state->surface->data_size; i; --i) {
-        *(dst++) = color;
+    const GL_Surface_t *surface = state->surface;
+    GL_Dirty_t *dirty = context->dirty;
+
+    GL_Quad_t area = (GL_Quad_t){ .x0 = 0, .y0 = 0, .x1 = (int)surface->width - 1, .y1 = (int)surface->height - 1 };
+    if (dirty && surface == dirty->surface) {
+        GL_context_flush(context);
+        if (dirty->cleared && dirty->background == state->background) {
+            area = dirty->extents;
+        }
+        dirty->extents = EMPTY_REGION;
+        dirty->cleared = true;
+        dirty->background = state->background;
     }
+
+    if (area.x0 > area.x1 || area.y0 > area.y1) { // Nothing has been drawn since the last clear.
+        return;
+    }
+
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_CLEAR, .var.clear = { .area = area } })) {
+        return;
+    }
+#endif
+
+    if (dirty && surface == dirty->surface) {
+        merge(&dirty->region, &area); // The clipping region is ignored.
+    }
+
+    GL_surface_fill(surface, &area, state->background);
 }
 
 void GL_context_to_surface(const GL_Context_t *context, const GL_Surface_t *to)
 {
+    GL_context_flush(context);
+
     const GL_State_t *state = &context->state;
     const GL_Surface_t *from = state->surface;
 
@@ -33,6 +33,9 @@
 
 #define GL_XFORM_TABLE_MAX_OPERATIONS       16
 
+#define GL_CONTEXT_STACK_CAPACITY           64
+#define GL_CONTEXT_TABLES_CAPACITY          (GL_CONTEXT_STACK_CAPACITY + 1) // Worst case, no state shares its tables.
+
 #ifdef __GL_MASK_SUPPORT__
 typedef struct _GL_Mask_t {
     const GL_Surface_t *stencil;
@@ -40,29 +43,80 @@ typedef struct _GL_Mask_t {
 } GL_Mask_t;
 #endif
 
+typedef enum _GL_Tables_Flags_t { // Properties of the state tables, to select specialized (faster) kernels.
+    GL_TABLES_IDENTITY = 0x01, // The shifting table is the identity.
+    GL_TABLES_OPAQUE = 0x02, // No index is transparent.
+    GL_TABLES_SINGLE_TRANSPARENT = 0x04 // Only the `transparent_key` index is transparent.
+} GL_Tables_Flags_t;
+
+// The (large) tables are shared among the current state and the stacked ones, and copied only when about to be
+// modified while shared.
+typedef struct _GL_Tables_t {
+    GL_Pixel_t shifting[GL_MAX_PALETTE_COLORS];
+    GL_Bool_t transparent[GL_MAX_PALETTE_COLORS];
+    size_t references; // Number of states using the tables, a zero count marks them as free.
+} GL_Tables_t;
+
+// Transparency of each (source) index once shifted, that is `transparent[shifting[i]]`, as a bitmap. Data derived
+// from the tables (e.g. the sheets compiled runs) depends only on this, which changes far less often than they do.
+typedef struct _GL_Transparency_t {
+    uint32_t bits[GL_MAX_PALETTE_COLORS / 32];
+} GL_Transparency_t;
+
 typedef struct _GL_State_t {
     GL_Surface_t *surface;
     GL_Quad_t clipping_region;
     GL_Pixel_t background;
     GL_Pixel_t color; // TODO: use it!
     uint32_t pattern; // TODO: ditto
-    GL_Pixel_t shifting[GL_MAX_PALETTE_COLORS];
-    GL_Bool_t transparent[GL_MAX_PALETTE_COLORS];
+    GL_Tables_t *tables;
+    const GL_Pixel_t *shifting; // Read-only views of the `tables` ones.
+    const GL_Bool_t *transparent;
+    uint32_t tables_id; // Changes on every update of the tables above, to detect when derived data is stale.
+    int tables_flags;
+    GL_Pixel_t transparent_key;
+    GL_Transparency_t transparency;
 #ifdef __GL_MASK_SUPPORT__
     GL_Mask_t mask;
 #endif
 } GL_State_t;
 
+// Tracks the region of a surface (i.e. the context buffer) that has been changed by drawing operations. Since they
+// operate on a `const` context, it's kept aside and referenced by pointer. The region is empty when `x0 > x1`.
+// The extents of what has been drawn since the last clear are tracked, too, so that the next clear (with the same
+// background) can be limited to them.
+typedef struct _GL_Dirty_t {
+    const GL_Surface_t *surface;
+    GL_Quad_t region;
+    GL_Quad_t extents;
+    bool cleared; // Pixels outside the `extents` are known to be equal to `background`.
+    GL_Pixel_t background;
+} GL_Dirty_t;
+
+#ifdef __GL_DEFERRED_SUPPORT__
+struct _GL_Deferred_t;
+#endif
+
 typedef struct _GL_Context_t {
     GL_Surface_t buffer;
     GL_State_t state;
-    GL_State_t *stack;
+    GL_State_t *stack; // Both preallocated, pushing/popping a state doesn't allocate.
+    size_t depth;
+    GL_Tables_t *tables;
+    GL_Dirty_t *dirty;
+#ifdef __GL_DEFERRED_SUPPORT__
+    struct _GL_Deferred_t *deferred; // When attached, drawing on the buffer is recorded and executed in bands.
+#endif
 } GL_Context_t;
 
 extern bool GL_context_create(GL_Context_t *context, size_t width, size_t height);
 extern void GL_context_delete(GL_Context_t *context); // TODO: rename to `*_destroy()`?
+#ifdef __GL_DEFERRED_SUPPORT__
+extern bool GL_context_defer(GL_Context_t *context, size_t workers);
+#endif
+extern void GL_context_flush(const GL_Context_t *context);
 
-extern void GL_context_push(GL_Context_t *context);
+extern bool GL_context_push(GL_Context_t *context);
 extern void GL_context_pop(GL_Context_t *context);
 extern void GL_context_reset(GL_Context_t *context);
 extern void GL_context_sanitize(GL_Context_t *context, const GL_Surface_t *surface);
@@ -78,6 +132,10 @@ extern void GL_context_pattern(GL_Context_t *context, uint32_t pattern);
 extern void GL_context_mask(GL_Context_t *context, const GL_Mask_t *mask);
 #endif
 
+extern void GL_context_dirty(const GL_Context_t *context, const GL_Quad_t *region);
+extern bool GL_context_collect_dirty(const GL_Context_t *context, GL_Quad_t *region);
+extern void GL_context_to_rgba_rows(const GL_Context_t *context, const GL_Palette_t *palette, GL_Color_t *vram, size_t first, size_t count);
+
 extern void GL_context_clear(const GL_Context_t *context);
 extern void GL_context_to_surface(const GL_Context_t *context, const GL_Surface_t *to);
 
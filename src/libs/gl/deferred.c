@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#include "deferred.h"
+
+#include <config.h>
+
+#ifdef __GL_DEFERRED_SUPPORT__
+#include <libs/imath.h>
+#include <libs/log.h>
+#include <libs/stb.h>
+
+#include "blit.h"
+#include "primitive.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_CONTEXT "deferred"
+
+#define NO_TABLE    ((size_t)-1)
+
+#define EMPTY_REGION    (GL_Quad_t){ .x0 = INT_MAX, .y0 = INT_MAX, .x1 = INT_MIN, .y1 = INT_MIN }
+
+// Same as `arrsetlen(a, 0)`, which can't be used with a zero length due to the (signedness) warnings.
+#define ARRAY_RESET(a)  ((a) ? stbds_header(a)->length = 0 : 0)
+
+static inline GL_Quad_t band_of(const GL_Surface_t *buffer, size_t index, size_t count)
+{
+    return (GL_Quad_t){
+            .x0 = 0,
+            .y0 = (int)((buffer->height * index) / count),
+            .x1 = (int)buffer->width - 1,
+            .y1 = (int)((buffer->height * (index + 1)) / count) - 1
+        };
+}
+
+// Only blits and primitives that yield the same pixels regardless of the clipping region can be split in bands.
+// Lines are clipped by moving the end-points (with rounding) and the x-form blitter depends on the clipping region
+// origin. Triangles spans are solved exactly for each row, and can be split.
+static inline bool is_serial(GL_Command_Types_t type)
+{
+    return type == GL_COMMAND_POLYLINE || type == GL_COMMAND_BLIT_X;
+}
+
+static inline void merge(GL_Quad_t *region, const GL_Quad_t *other)
+{
+    region->x0 = imin(region->x0, other->x0);
+    region->y0 = imin(region->y0, other->y0);
+    region->x1 = imax(region->x1, other->x1);
+    region->y1 = imax(region->y1, other->y1);
+}
+
+// Clear the part of the area that falls into the band, returning `false` when there's none.
+static bool clear(const GL_Surface_t *surface, const GL_Quad_t *band, const GL_Quad_t *area, GL_Pixel_t index, GL_Quad_t *cleared)
+{
+    *cleared = (GL_Quad_t){ .x0 = area->x0, .y0 = imax(area->y0, band->y0), .x1 = area->x1, .y1 = imin(area->y1, band->y1) };
+    if (cleared->y0 > cleared->y1) {
+        return false;
+    }
+    GL_surface_fill(surface, cleared, index);
+    return true;
+}
+
+static void execute(const GL_Context_t *context, const GL_Deferred_t *deferred, const GL_Command_t *command)
+{
+    switch (command->type) {
+        case GL_COMMAND_CLEAR: {
+            break; // Handled by the caller, as it doesn't honour the clipping region.
+        }
+        case GL_COMMAND_BLIT: {
+            GL_context_blit(context, command->var.blit.surface, command->var.blit.area, command->var.blit.position);
+            break;
+        }
+        case GL_COMMAND_BLIT_S: {
+            GL_context_blit_s(context, command->var.blit.surface, command->var.blit.area, command->var.blit.position,
+                command->var.blit.scale_x, command->var.blit.scale_y);
+            break;
+        }
+        case GL_COMMAND_BLIT_SR: {
+            GL_context_blit_sr(context, command->var.blit.surface, command->var.blit.area, command->var.blit.position,
+                command->var.blit.scale_x, command->var.blit.scale_y, command->var.blit.rotation,
+                command->var.blit.anchor_x, command->var.blit.anchor_y);
+            break;
+        }
+        case GL_COMMAND_BLIT_X: {
+            GL_XForm_t xform = command->var.xform.xform;
+            xform.table = command->var.xform.table == NO_TABLE ? NULL : deferred->tables + command->var.xform.table;
+            GL_context_blit_x(context, command->var.xform.surface, command->var.xform.position, &xform);
+            break;
+        }
+        case GL_COMMAND_BLIT_COMPILED: {
+            GL_context_blit_compiled(context, command->var.compiled.sheet, command->var.compiled.runs,
+                command->var.compiled.cell_id, command->var.compiled.position);
+            break;
+        }
+        case GL_COMMAND_POINT: {
+            GL_primitive_point(context, command->var.primitive.position, command->var.primitive.index);
+            break;
+        }
+        case GL_COMMAND_HLINE: {
+            GL_primitive_hline(context, command->var.primitive.position, command->var.primitive.length, command->var.primitive.index);
+            break;
+        }
+        case GL_COMMAND_VLINE: {
+            GL_primitive_vline(context, command->var.primitive.position, command->var.primitive.length, command->var.primitive.index);
+            break;
+        }
+        case GL_COMMAND_POLYLINE: {
+            GL_primitive_polyline(context, deferred->vertices + command->var.shape.offset, command->var.shape.count, command->var.shape.index);
+            break;
+        }
+        case GL_COMMAND_PROCESS: {
+            GL_context_process(context, command->var.rectangle.rectangle);
+            break;
+        }
+        case GL_COMMAND_FILLED_RECTANGLE: {
+            GL_primitive_filled_rectangle(context, command->var.rectangle.rectangle, command->var.rectangle.index);
+            break;
+        }
+        case GL_COMMAND_FILLED_TRIANGLE: {
+            GL_primitive_filled_triangle(context, command->var.triangle.a, command->var.triangle.b, command->var.triangle.c, command->var.triangle.index);
+            break;
+        }
+        case GL_COMMAND_TRIANGLES: {
+            GL_primitive_triangles(context, deferred->vertices + command->var.shape.offset, command->var.shape.count, command->var.shape.index);
+            break;
+        }
+        case GL_COMMAND_TEXTURED_TRIANGLES: {
+            GL_primitive_textured_triangles(context, command->var.mesh.surface, deferred->meshes + command->var.mesh.offset, command->var.mesh.count);
+            break;
+        }
+        case GL_COMMAND_FILLED_CIRCLE: {
+            GL_primitive_filled_circle(context, command->var.primitive.position, command->var.primitive.radius, command->var.primitive.index);
+            break;
+        }
+        case GL_COMMAND_CIRCLE: {
+            GL_primitive_circle(context, command->var.primitive.position, command->var.primitive.radius, command->var.primitive.index);
+            break;
+        }
+        case GL_COMMAND_TO_RGBA: { // Band-wise, handled by `run()`.
+            break;
+        }
+    }
+}
+
+// Each band converts its own rows only, the ones that have been drawn by the (same band) preceding commands.
+static void to_rgba(const GL_Command_t *command, const GL_Quad_t *band)
+{
+    const int first = imax((int)command->var.rgba.first, band->y0);
+    const int last = imin((int)(command->var.rgba.first + command->var.rgba.count) - 1, band->y1);
+    if (first > last) {
+        return;
+    }
+    GL_surface_to_rgba_rows(command->var.rgba.surface, command->var.rgba.palette, command->var.rgba.vram, (size_t)first, (size_t)(last - first + 1));
+}
+
+// Executes the commands in the `[first, last)` range, restricting the clipping region of each state to the band.
+// The context is a private copy with no deferred storage attached, so that the commands are executed immediately.
+// It also tracks its own dirty region and drawing extents, which are merged into the `output` argument once done.
+// Clearing changes the dirty region only, as the extents have already been reset when the command was recorded.
+static void run(const GL_Deferred_t *deferred, size_t first, size_t last, const GL_Quad_t *band, GL_Dirty_t *output)
+{
+    GL_Dirty_t dirty = (GL_Dirty_t){ .surface = NULL, .region = EMPTY_REGION, .extents = EMPTY_REGION };
+    GL_Context_t context = (GL_Context_t){ .dirty = &dirty };
+    size_t current = NO_TABLE;
+    bool visible = false;
+
+    for (size_t i = first; i < last; ++i) {
+        const GL_Command_t *command = &deferred->commands[i];
+
+        if (command->type == GL_COMMAND_TO_RGBA) { // Doesn't draw, no state is attached to it.
+            to_rgba(command, band);
+            continue;
+        }
+
+        if (command->state != current) { // Commands are sorted by state, rebuild the band state only when it changes.
+            current = command->state;
+            context.state = deferred->states[current];
+            const GL_Tables_t *lookup = &deferred->lookups[deferred->bindings[current]];
+            context.state.tables = NULL;
+            context.state.shifting = lookup->shifting;
+            context.state.transparent = lookup->transparent;
+            dirty.surface = context.state.surface;
+            GL_Quad_t *clipping_region = &context.state.clipping_region;
+            clipping_region->y0 = imax(clipping_region->y0, band->y0);
+            clipping_region->y1 = imin(clipping_region->y1, band->y1);
+            visible = clipping_region->y0 <= clipping_region->y1;
+        }
+
+        if (command->type == GL_COMMAND_CLEAR) {
+            GL_Quad_t cleared;
+            if (clear(context.state.surface, band, &command->var.clear.area, context.state.background, &cleared)) {
+                merge(&dirty.region, &cleared);
+            }
+        } else
+        if (visible) {
+            execute(&context, deferred, command);
+        }
+    }
+
+    merge(&output->region, &dirty.region);
+    merge(&output->extents, &dirty.extents);
+}
+
+static void *worker(void *arg)
+{
+    GL_Deferred_Worker_t *worker = (GL_Deferred_Worker_t *)arg;
+    GL_Deferred_t *deferred = worker->deferred;
+
+    size_t generation = 0;
+
+    pthread_mutex_lock(&deferred->mutex);
+    for (;;) {
+        while (!deferred->quit && deferred->generation == generation) {
+            pthread_cond_wait(&deferred->start, &deferred->mutex);
+        }
+        if (deferred->quit) {
+            break;
+        }
+        generation = deferred->generation;
+        const size_t first = deferred->first;
+        const size_t last = deferred->last;
+        pthread_mutex_unlock(&deferred->mutex);
+
+        run(deferred, first, last, &worker->band, &worker->dirty);
+
+        pthread_mutex_lock(&deferred->mutex);
+        if (--deferred->pending == 0) {
+            pthread_cond_signal(&deferred->done);
+        }
+    }
+    pthread_mutex_unlock(&deferred->mutex);
+
+    return NULL;
+}
+
+static void dispatch(GL_Deferred_t *deferred, size_t first, size_t last)
+{
+    pthread_mutex_lock(&deferred->mutex);
+    deferred->first = first;
+    deferred->last = last;
+    deferred->pending = deferred->count;
+    for (size_t i = 0; i < deferred->count; ++i) {
+        deferred->workers[i].dirty = (GL_Dirty_t){ .region = EMPTY_REGION, .extents = EMPTY_REGION };
+    }
+    deferred->generation += 1;
+    pthread_cond_broadcast(&deferred->start);
+    pthread_mutex_unlock(&deferred->mutex);
+
+    GL_Dirty_t *dirty = deferred->dirty;
+
+    run(deferred, first, last, &deferred->band, dirty); // The calling thread takes care of its own band, too.
+
+    pthread_mutex_lock(&deferred->mutex);
+    while (deferred->pending > 0) {
+        pthread_cond_wait(&deferred->done, &deferred->mutex);
+    }
+    for (size_t i = 0; i < deferred->count; ++i) {
+        merge(&dirty->region, &deferred->workers[i].dirty.region);
+        merge(&dirty->extents, &deferred->workers[i].dirty.extents);
+    }
+    pthread_mutex_unlock(&deferred->mutex);
+}
+
+bool GL_deferred_create(GL_Deferred_t *deferred, const GL_Surface_t *buffer, GL_Dirty_t *dirty, size_t workers)
+{
+    *deferred = (GL_Deferred_t){ .dirty = dirty };
+
+    const size_t bands = workers + 1 < buffer->height ? workers + 1 : buffer->height; // At least a row per band.
+
+    deferred->area = (GL_Quad_t){ .x0 = 0, .y0 = 0, .x1 = (int)buffer->width - 1, .y1 = (int)buffer->height - 1 };
+    deferred->band = band_of(buffer, 0, bands);
+
+    deferred->workers = malloc((bands - 1) * sizeof(GL_Deferred_Worker_t));
+    if (!deferred->workers && bands > 1) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate workers");
+        return false;
+    }
+
+    pthread_mutex_init(&deferred->mutex, NULL);
+    pthread_cond_init(&deferred->start, NULL);
+    pthread_cond_init(&deferred->done, NULL);
+
+    for (size_t i = 0; i < bands - 1; ++i) {
+        GL_Deferred_Worker_t *worker_i = &deferred->workers[i];
+        *worker_i = (GL_Deferred_Worker_t){ .deferred = deferred, .band = band_of(buffer, i + 1, bands) };
+        if (pthread_create(&worker_i->thread, NULL, worker, worker_i) != 0) {
+            Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't create worker #%d", i);
+            GL_deferred_delete(deferred);
+            return false;
+        }
+        deferred->count += 1;
+    }
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "deferred rendering created w/ %d bands", bands);
+    return true;
+}
+
+void GL_deferred_delete(GL_Deferred_t *deferred)
+{
+    pthread_mutex_lock(&deferred->mutex);
+    deferred->quit = true;
+    pthread_cond_broadcast(&deferred->start);
+    pthread_mutex_unlock(&deferred->mutex);
+
+    for (size_t i = 0; i < deferred->count; ++i) {
+        pthread_join(deferred->workers[i].thread, NULL);
+    }
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "%d workers joined", deferred->count);
+
+    pthread_cond_destroy(&deferred->done);
+    pthread_cond_destroy(&deferred->start);
+    pthread_mutex_destroy(&deferred->mutex);
+
+    free(deferred->workers);
+
+    arrfree(deferred->commands);
+    arrfree(deferred->states);
+    arrfree(deferred->vertices);
+    arrfree(deferred->meshes);
+    arrfree(deferred->tables);
+    arrfree(deferred->lookups);
+    arrfree(deferred->bindings);
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "deferred rendering deleted");
+}
+
+static inline const GL_Surface_t *source_of(const GL_Command_t *command)
+{
+    switch (command->type) {
+        case GL_COMMAND_BLIT:
+        case GL_COMMAND_BLIT_S:
+        case GL_COMMAND_BLIT_SR: {
+            return command->var.blit.surface;
+        }
+        case GL_COMMAND_BLIT_X: {
+            return command->var.xform.surface;
+        }
+        case GL_COMMAND_BLIT_COMPILED: {
+            return &command->var.compiled.sheet->atlas;
+        }
+        case GL_COMMAND_TEXTURED_TRIANGLES: {
+            return command->var.mesh.surface;
+        }
+        default: {
+            return NULL;
+        }
+    }
+}
+
+bool GL_deferred_record(const GL_Context_t *context, const GL_Command_t *command)
+{
+    GL_Deferred_t *deferred = context->deferred;
+    const GL_State_t *state = &context->state;
+
+    // Only the context buffer is rendered in bands. When drawing on a different surface, or reading back the
+    // buffer as a source, the pending commands are completed and the current one is executed immediately.
+    bool deferrable = state->surface == &context->buffer && source_of(command) != state->surface;
+#ifdef __GL_MASK_SUPPORT__
+    deferrable = deferrable && state->mask.stencil != state->surface;
+#endif
+    if (!deferrable) {
+        GL_deferred_flush(deferred);
+        return false;
+    }
+
+    const size_t states = arrlen(deferred->states);
+    if (states == 0 || memcmp(&deferred->states[states - 1], state, sizeof(GL_State_t)) != 0) {
+        if (states == 0 || deferred->states[states - 1].tables_id != state->tables_id) { // Copy only when changed.
+            arrpush(deferred->lookups, *state->tables);
+        }
+        arrpush(deferred->bindings, arrlen(deferred->lookups) - 1);
+        arrpush(deferred->states, *state);
+    }
+
+    GL_Command_t entry = *command;
+    entry.state = arrlen(deferred->states) - 1;
+
+    if (entry.type == GL_COMMAND_POLYLINE || entry.type == GL_COMMAND_TRIANGLES) {
+        entry.var.shape.offset = arrlen(deferred->vertices);
+        for (size_t i = 0; i < entry.var.shape.count; ++i) {
+            arrpush(deferred->vertices, entry.var.shape.vertices[i]);
+        }
+        entry.var.shape.vertices = NULL;
+    } else
+    if (entry.type == GL_COMMAND_TEXTURED_TRIANGLES) {
+        entry.var.mesh.offset = arrlen(deferred->meshes);
+        for (size_t i = 0; i < entry.var.mesh.count; ++i) {
+            arrpush(deferred->meshes, entry.var.mesh.vertices[i]);
+        }
+        entry.var.mesh.vertices = NULL;
+    } else
+    if (entry.type == GL_COMMAND_BLIT_X) {
+        const GL_XForm_Scan_Line_t *table = entry.var.xform.xform.table;
+        entry.var.xform.table = table ? (size_t)arrlen(deferred->tables) : NO_TABLE;
+        if (table) {
+            for (size_t i = 0; i < entry.var.xform.xform.scan_lines; ++i) {
+                arrpush(deferred->tables, table[i]);
+            }
+        }
+        entry.var.xform.xform.table = NULL;
+    }
+
+    arrpush(deferred->commands, entry);
+
+    return true;
+}
+
+void GL_deferred_flush(GL_Deferred_t *deferred)
+{
+    const size_t count = arrlen(deferred->commands);
+
+    for (size_t first = 0; first < count; ) { // Parallel runs are interleaved with the serial commands.
+        size_t last = first;
+        while (last < count && !is_serial(deferred->commands[last].type)) {
+            ++last;
+        }
+        if (last > first) {
+            dispatch(deferred, first, last);
+        }
+        if (last < count) {
+            run(deferred, last, last + 1, &deferred->area, deferred->dirty);
+            ++last;
+        }
+        first = last;
+    }
+
+    ARRAY_RESET(deferred->commands); // Keep the storage, it will be reused on the next frame.
+    ARRAY_RESET(deferred->states);
+    ARRAY_RESET(deferred->vertices);
+    ARRAY_RESET(deferred->meshes);
+    ARRAY_RESET(deferred->tables);
+    ARRAY_RESET(deferred->lookups);
+    ARRAY_RESET(deferred->bindings);
+}
+// The conversion is appended to the pending commands and executed along with them, split among the bands.
+void GL_deferred_to_rgba_rows(GL_Deferred_t *deferred, const GL_Surface_t *surface, const GL_Palette_t *palette, GL_Color_t *vram, size_t first, size_t count)
+{
+    const GL_Command_t command = (GL_Command_t){
+            .type = GL_COMMAND_TO_RGBA,
+            .var.rgba = { .surface = surface, .palette = palette, .vram = vram, .first = first, .count = count }
+        };
+    arrpush(deferred->commands, command);
+    GL_deferred_flush(deferred);
+}
+#endif
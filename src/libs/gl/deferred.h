@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#ifndef __GL_DEFERRED_H__
+#define __GL_DEFERRED_H__
+
+#include <config.h>
+
+#ifdef __GL_DEFERRED_SUPPORT__
+#include "common.h"
+#include "context.h"
+#include "sheet.h"
+#include "surface.h"
+#include "xform.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef enum _GL_Command_Types_t {
+    GL_COMMAND_CLEAR,
+    GL_COMMAND_BLIT,
+    GL_COMMAND_BLIT_S,
+    GL_COMMAND_BLIT_SR,
+    GL_COMMAND_BLIT_X,
+    GL_COMMAND_BLIT_COMPILED,
+    GL_COMMAND_POINT,
+    GL_COMMAND_HLINE,
+    GL_COMMAND_VLINE,
+    GL_COMMAND_POLYLINE,
+    GL_COMMAND_PROCESS,
+    GL_COMMAND_FILLED_RECTANGLE,
+    GL_COMMAND_FILLED_TRIANGLE,
+    GL_COMMAND_TRIANGLES,
+    GL_COMMAND_TEXTURED_TRIANGLES,
+    GL_COMMAND_FILLED_CIRCLE,
+    GL_COMMAND_CIRCLE,
+    GL_COMMAND_TO_RGBA
+} GL_Command_Types_t;
+
+// Commands are recorded with the index of the state snapshot they need to be executed with. Any data that
+// the caller could release (or change) before the command is executed is copied into the deferred storage.
+typedef struct _GL_Command_t {
+    GL_Command_Types_t type;
+    size_t state;
+    union {
+        struct {
+            const GL_Surface_t *surface;
+            GL_Rectangle_t area;
+            GL_Point_t position;
+            float scale_x, scale_y;
+            int rotation;
+            float anchor_x, anchor_y;
+        } blit;
+        struct {
+            const GL_Surface_t *surface;
+            GL_Point_t position;
+            GL_XForm_t xform;
+            size_t table; // Offset into the tables storage, or `-1` when the transformation has no table.
+        } xform;
+        struct {
+            const GL_Sheet_t *sheet;
+            const GL_Sheet_Runs_t *runs; // Owned by the sheet, and kept until it is detached.
+            size_t cell_id;
+            GL_Point_t position;
+        } compiled;
+        struct {
+            GL_Point_t position;
+            size_t length;
+            int radius;
+            GL_Pixel_t index;
+        } primitive;
+        struct {
+            const GL_Point_t *vertices; // Valid only while recording, replaced by `offset` into the storage.
+            size_t offset;
+            size_t count;
+            GL_Pixel_t index;
+        } shape; // Polylines and triangles batches.
+        struct {
+            const GL_Surface_t *surface;
+            const GL_Vertex_t *vertices; // As above, replaced by `offset` into the storage once recorded.
+            size_t offset;
+            size_t count;
+        } mesh;
+        struct {
+            GL_Rectangle_t rectangle;
+            GL_Pixel_t index;
+        } rectangle;
+        struct {
+            GL_Quad_t area; // Not the whole buffer, when clearing only what has been drawn since the last clear.
+        } clear;
+        struct {
+            GL_Point_t a, b, c;
+            GL_Pixel_t index;
+        } triangle;
+        struct {
+            const GL_Surface_t *surface;
+            const GL_Palette_t *palette;
+            GL_Color_t *vram;
+            size_t first, count;
+        } rgba;
+    } var;
+} GL_Command_t;
+
+typedef struct _GL_Deferred_Worker_t {
+    struct _GL_Deferred_t *deferred;
+    pthread_t thread;
+    GL_Quad_t band;
+    GL_Dirty_t dirty;
+} GL_Deferred_Worker_t;
+
+// The buffer is split in horizontal bands, one for each worker thread plus one for the calling thread. Commands are
+// collected until the buffer content is needed, then executed in parallel, each band clipping to its own rows.
+// Commands whose output depends on the clipping region (i.e. they couldn't be split with no seams) are executed
+// serially, once the preceding ones are completed.
+typedef struct _GL_Deferred_t {
+    GL_Command_t *commands;
+    GL_State_t *states;
+    GL_Point_t *vertices;
+    GL_Vertex_t *meshes;
+    GL_XForm_Scan_Line_t *tables;
+    GL_Tables_t *lookups; // Copies of the states tables, as the context ones can be modified in place once recorded.
+    size_t *bindings; // For each state, the index of its `lookups` entry.
+    GL_Dirty_t *dirty; // The context one, updated with the regions the commands have drawn on.
+
+    GL_Quad_t area; // The whole buffer, for the commands that are executed serially.
+    GL_Quad_t band; // The one of the calling thread.
+    GL_Deferred_Worker_t *workers;
+    size_t count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    size_t generation;
+    size_t pending;
+    size_t first, last;
+    bool quit;
+} GL_Deferred_t;
+
+extern bool GL_deferred_create(GL_Deferred_t *deferred, const GL_Surface_t *buffer, GL_Dirty_t *dirty, size_t workers);
+extern void GL_deferred_delete(GL_Deferred_t *deferred);
+
+extern bool GL_deferred_record(const GL_Context_t *context, const GL_Command_t *command);
+extern void GL_deferred_flush(GL_Deferred_t *deferred);
+extern void GL_deferred_to_rgba_rows(GL_Deferred_t *deferred, const GL_Surface_t *surface, const GL_Palette_t *palette, GL_Color_t *vram, size_t first, size_t count);
+#endif
+
+#endif  /* __GL_DEFERRED_H__ */
@@ -22,14 +22,38 @@
 
 #include "palette.h"
 
+#include <config.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__GL_SIMD_SUPPORT__)
+  #if defined(__SSE2__)
+    #include <emmintrin.h>
+
+    #define __PALETTE_SSE2__
+  #endif
+#endif
+
 #define RED_WEIGHT      2.0f
 #define GREEN_WEIGHT    4.0f
 #define BLUE_WEIGHT     3.0f
 
+// Size of the (direct-mapped) cache of the already matched colors, must be a power of two.
+#define MATCH_CACHE_SIZE    1024
+#define MATCH_CACHE_VALID   0x01000000u
+
+// The palette colors are stored as separate (and padded) component planes, to be compared in parallel.
+#define PLANES_LANES        8
+
+typedef struct _Palette_Planes_t {
+    int16_t r[GL_MAX_PALETTE_COLORS];
+    int16_t g[GL_MAX_PALETTE_COLORS];
+    int16_t b[GL_MAX_PALETTE_COLORS];
+    size_t count; // Rounded up to the lanes count.
+} Palette_Planes_t;
+
 void GL_palette_greyscale(GL_Palette_t *palette, const size_t count)
 {
     for (size_t i = 0; i < count; ++i) {
@@ -84,4 +108,137 @@ GL_Pixel_t GL_palette_find_nearest_color(const GL_Palette_t *palette, const GL_C
         }
     }
     return index;
-}
\ No newline at end of file
+}
+
+#ifndef __FIND_NEAREST_COLOR_EUCLIDIAN__
+// The padding lanes replicate the first color. Being later in the palette, they never win a tie against it.
+static void planes_prepare(Palette_Planes_t *planes, const GL_Palette_t *palette)
+{
+    const size_t count = (palette->count + PLANES_LANES - 1) & ~(size_t)(PLANES_LANES - 1);
+    for (size_t i = 0; i < count; ++i) {
+        const GL_Color_t *color = &palette->colors[i < palette->count ? i : 0];
+        planes->r[i] = color->r;
+        planes->g[i] = color->g;
+        planes->b[i] = color->b;
+    }
+    planes->count = count;
+}
+
+// The (weighted) squared distance is computed on integers, which gives the very same results of the floating-point
+// one (all the values are exactly representable) and, ties included, the same index.
+#if defined(__PALETTE_SSE2__)
+static GL_Pixel_t planes_nearest(const Palette_Planes_t *planes, int r, int g, int b)
+{
+    const __m128i cr = _mm_set1_epi16((int16_t)r);
+    const __m128i cg = _mm_set1_epi16((int16_t)g);
+    const __m128i cb = _mm_set1_epi16((int16_t)b);
+    const __m128i wrg = _mm_set1_epi32(((int)GREEN_WEIGHT << 16) | (int)RED_WEIGHT); // Interleaved as the deltas are.
+    const __m128i wb = _mm_set1_epi32((int)BLUE_WEIGHT);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i four = _mm_set1_epi32(4);
+
+    __m128i minimum_lo = _mm_set1_epi32(INT32_MAX), minimum_hi = minimum_lo;
+    __m128i index_lo = _mm_setzero_si128(), index_hi = index_lo;
+    __m128i current_lo = _mm_setr_epi32(0, 1, 2, 3), current_hi = _mm_setr_epi32(4, 5, 6, 7);
+
+    for (size_t i = 0; i < planes->count; i += PLANES_LANES) {
+        const __m128i dr = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(planes->r + i)), cr);
+        const __m128i dg = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(planes->g + i)), cg);
+        const __m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(planes->b + i)), cb);
+
+        // `madd` multiplies and sums adjacent pairs, that is `dr * dr * wr + dg * dg * wg` on interleaved deltas.
+        const __m128i rg_lo = _mm_unpacklo_epi16(dr, dg);
+        const __m128i rg_hi = _mm_unpackhi_epi16(dr, dg);
+        const __m128i b_lo = _mm_unpacklo_epi16(db, zero);
+        const __m128i b_hi = _mm_unpackhi_epi16(db, zero);
+        const __m128i distance_lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, _mm_mullo_epi16(rg_lo, wrg)), _mm_madd_epi16(b_lo, _mm_mullo_epi16(b_lo, wb)));
+        const __m128i distance_hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, _mm_mullo_epi16(rg_hi, wrg)), _mm_madd_epi16(b_hi, _mm_mullo_epi16(b_hi, wb)));
+
+        const __m128i less_lo = _mm_cmplt_epi32(distance_lo, minimum_lo); // Strictly, to keep the first minimum.
+        const __m128i less_hi = _mm_cmplt_epi32(distance_hi, minimum_hi);
+        minimum_lo = _mm_or_si128(_mm_and_si128(less_lo, distance_lo), _mm_andnot_si128(less_lo, minimum_lo));
+        minimum_hi = _mm_or_si128(_mm_and_si128(less_hi, distance_hi), _mm_andnot_si128(less_hi, minimum_hi));
+        index_lo = _mm_or_si128(_mm_and_si128(less_lo, current_lo), _mm_andnot_si128(less_lo, index_lo));
+        index_hi = _mm_or_si128(_mm_and_si128(less_hi, current_hi), _mm_andnot_si128(less_hi, index_hi));
+
+        current_lo = _mm_add_epi32(current_lo, _mm_add_epi32(four, four));
+        current_hi = _mm_add_epi32(current_hi, _mm_add_epi32(four, four));
+    }
+
+    int32_t minimums[PLANES_LANES], indexes[PLANES_LANES];
+    _mm_storeu_si128((__m128i *)minimums, minimum_lo);
+    _mm_storeu_si128((__m128i *)(minimums + 4), minimum_hi);
+    _mm_storeu_si128((__m128i *)indexes, index_lo);
+    _mm_storeu_si128((__m128i *)(indexes + 4), index_hi);
+
+    size_t best = 0;
+    for (size_t i = 1; i < PLANES_LANES; ++i) { // On ties, the lower index wins.
+        if (minimums[i] < minimums[best] || (minimums[i] == minimums[best] && indexes[i] < indexes[best])) {
+            best = i;
+        }
+    }
+    return (GL_Pixel_t)indexes[best];
+}
+#else
+static GL_Pixel_t planes_nearest(const Palette_Planes_t *planes, int r, int g, int b)
+{
+    GL_Pixel_t index = 0;
+    int32_t minimum = INT32_MAX;
+    for (size_t i = 0; i < planes->count; ++i) {
+        const int32_t delta_r = planes->r[i] - r;
+        const int32_t delta_g = planes->g[i] - g;
+        const int32_t delta_b = planes->b[i] - b;
+        const int32_t distance = (delta_r * delta_r) * (int32_t)RED_WEIGHT
+            + (delta_g * delta_g) * (int32_t)GREEN_WEIGHT
+            + (delta_b * delta_b) * (int32_t)BLUE_WEIGHT;
+        if (minimum > distance) {
+            minimum = distance;
+            index = (GL_Pixel_t)i;
+        }
+    }
+    return index;
+}
+#endif
+#endif
+
+// Images have (usually) a limited amount of distinct colors, repeated over and over. Each color is searched in the
+// palette only the first time it is met (or when evicted from the cache by a colliding one), and runs of the same
+// color are detected, too.
+void GL_palette_find_nearest_colors(const GL_Palette_t *palette, GL_Pixel_t *indexes, const uint8_t *rgba, size_t count)
+{
+#ifdef __FIND_NEAREST_COLOR_EUCLIDIAN__
+    for (size_t i = count; i; --i) {
+        *(indexes++) = GL_palette_find_nearest_color(palette, (GL_Color_t){ .r = rgba[0], .g = rgba[1], .b = rgba[2], .a = rgba[3] });
+        rgba += 4;
+    }
+#else
+    if (palette->count == 0) {
+        memset(indexes, 0, count);
+        return;
+    }
+
+    Palette_Planes_t planes;
+    planes_prepare(&planes, palette);
+
+    uint32_t keys[MATCH_CACHE_SIZE] = { 0 }; // No key is valid, initially.
+    GL_Pixel_t values[MATCH_CACHE_SIZE];
+
+    uint32_t last_key = 0;
+    GL_Pixel_t last_value = 0;
+
+    for (size_t i = count; i; --i) {
+        const uint32_t key = MATCH_CACHE_VALID | ((uint32_t)rgba[0] << 16) | ((uint32_t)rgba[1] << 8) | (uint32_t)rgba[2];
+        if (key != last_key) {
+            const size_t slot = (key * 2654435761u) >> 22 & (MATCH_CACHE_SIZE - 1); // Multiplicative (Knuth's) hashing.
+            if (keys[slot] != key) {
+                keys[slot] = key;
+                values[slot] = planes_nearest(&planes, rgba[0], rgba[1], rgba[2]);
+            }
+            last_key = key;
+            last_value = values[slot];
+        }
+        *(indexes++) = last_value;
+        rgba += 4;
+    }
+#endif
+}
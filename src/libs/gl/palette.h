@@ -24,6 +24,7 @@
 #define __GL_PALETTE_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "common.h"
 
@@ -38,5 +39,6 @@ extern void GL_palette_greyscale(GL_Palette_t *palette, size_t count);
 extern GL_Color_t GL_palette_unpack_color(uint32_t argb);
 extern uint32_t GL_palette_pack_color(const GL_Color_t color);
 extern GL_Pixel_t GL_palette_find_nearest_color(const GL_Palette_t *palette, const GL_Color_t color);
+extern void GL_palette_find_nearest_colors(const GL_Palette_t *palette, GL_Pixel_t *indexes, const uint8_t *rgba, size_t count);
 
 #endif  /* __GL_PALETTE_H__ */
\ No newline at end of file
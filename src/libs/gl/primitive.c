@@ -27,6 +27,9 @@
 #include <libs/gl/gl.h>
 #include <libs/stb.h>
 
+#include "deferred.h"
+#include "span.h"
+
 #include <math.h>
 
 #define REGION_INSIDE   0
@@ -35,6 +38,16 @@
 #define REGION_RIGHT    4
 #define REGION_BELOW    8
 
+// 16.16 fixed-point arithmetic, used to step the texture coordinates of the textured triangles.
+#define FIXED_SHIFT     16
+#define FIXED_ONE       (1 << FIXED_SHIFT)
+
+#define FLOAT_TO_FIXED64(f)     ((int64_t)floor((double)(f) * (double)FIXED_ONE + 0.5))
+#define FIXED_FLOOR(x)          ((x) >> FIXED_SHIFT) // Non-negative values only.
+
+// Maximum amount of texels sampled as a single span, before being drawn. Wider rows are processed in chunks.
+#define TEXTURED_SPAN_LENGTH    512
+
 static void point(const GL_Surface_t *surface, const GL_Quad_t *clipping_region, int x, int y, GL_Pixel_t index)
 {
     if (x < clipping_region->x0) {
@@ -271,6 +284,13 @@ static void vline(const GL_Surface_t *surface, const GL_Quad_t *clipping_region,
 
 void GL_primitive_point(const GL_Context_t *context, GL_Point_t position, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_POINT,
+            .var.primitive = { .position = position, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -283,11 +303,20 @@ void GL_primitive_point(const GL_Context_t *context, GL_Point_t position, GL_Pix
         return;
     }
 
+    GL_context_dirty(context, &(GL_Quad_t){ .x0 = position.x, .y0 = position.y, .x1 = position.x, .y1 = position.y });
+
     point(surface, clipping_region, position.x, position.y, index);
 }
 
 void GL_primitive_hline(const GL_Context_t *context, GL_Point_t origin, size_t w, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_HLINE,
+            .var.primitive = { .position = origin, .length = w, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -300,11 +329,20 @@ void GL_primitive_hline(const GL_Context_t *context, GL_Point_t origin, size_t w
         return;
     }
 
+    GL_context_dirty(context, &(GL_Quad_t){ .x0 = origin.x, .y0 = origin.y, .x1 = origin.x + (int)w - 1, .y1 = origin.y });
+
     hline(surface, clipping_region, origin.x, origin.y, w, index);
 }
 
 void GL_primitive_vline(const GL_Context_t *context, GL_Point_t origin, size_t h, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_VLINE,
+            .var.primitive = { .position = origin, .length = h, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -317,11 +355,20 @@ void GL_primitive_vline(const GL_Context_t *context, GL_Point_t origin, size_t h
         return;
     }
 
+    GL_context_dirty(context, &(GL_Quad_t){ .x0 = origin.x, .y0 = origin.y, .x1 = origin.x, .y1 = origin.y + (int)h - 1 });
+
     vline(surface, clipping_region, origin.x, origin.y, h, index);
 }
 
 void GL_primitive_polyline(const GL_Context_t *context, const GL_Point_t *vertices, size_t count, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_POLYLINE,
+            .var.shape = { .vertices = vertices, .count = count, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -338,6 +385,15 @@ void GL_primitive_polyline(const GL_Context_t *context, const GL_Point_t *vertic
         return;
     }
 
+    GL_Quad_t bounds = (GL_Quad_t){ .x0 = vertices[0].x, .y0 = vertices[0].y, .x1 = vertices[0].x, .y1 = vertices[0].y };
+    for (size_t i = 1; i < count; ++i) {
+        bounds.x0 = imin(bounds.x0, vertices[i].x);
+        bounds.y0 = imin(bounds.y0, vertices[i].y);
+        bounds.x1 = imax(bounds.x1, vertices[i].x);
+        bounds.y1 = imax(bounds.y1, vertices[i].y);
+    }
+    GL_context_dirty(context, &bounds);
+
     const GL_Point_t *from = vertices;
     for (size_t i = 1; i < count; ++i) {
         const GL_Point_t *to = vertices + i;
@@ -348,10 +404,15 @@ void GL_primitive_polyline(const GL_Context_t *context, const GL_Point_t *vertic
 
 void GL_context_process(const GL_Context_t *context, GL_Rectangle_t rectangle)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_PROCESS,
+            .var.rectangle = { .rectangle = rectangle } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
-    const GL_Pixel_t *shifting = state->shifting;
-    const GL_Bool_t *transparent = state->transparent;
     const GL_Surface_t *surface = state->surface;
 
     GL_Quad_t drawing_region = (GL_Quad_t){
@@ -380,29 +441,33 @@ void GL_context_process(const GL_Context_t *context, GL_Rectangle_t rectangle)
         return;
     }
 
+    GL_context_dirty(context, &drawing_region);
+
+    if (state->tables_flags & GL_TABLES_IDENTITY) { // Nothing would change, bail out!
+        return;
+    }
+
     GL_Pixel_t *sddata = surface->data;
 
     const int sdwidth = surface->width;
 
     GL_Pixel_t *sdptr = sddata + drawing_region.y0 * sdwidth + drawing_region.x0;
 
-    const int sdskip = sdwidth - width;
-
     for (int i = height; i; --i) {
-        for (int j = width; j; --j) {
-            GL_Pixel_t index = shifting[*sdptr];
-            if (transparent[index]) {
-                sdptr++;
-            } else {
-                *(sdptr++) = index;
-            }
-        }
-        sdptr += sdskip;
+        GL_span_blit(sdptr, sdptr, (size_t)width, state); // In-place processing.
+        sdptr += sdwidth;
     }
 }
 
 void GL_primitive_filled_rectangle(const GL_Context_t *context, GL_Rectangle_t rectangle, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_FILLED_RECTANGLE,
+            .var.rectangle = { .rectangle = rectangle, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -441,28 +506,132 @@ void GL_primitive_filled_rectangle(const GL_Context_t *context, GL_Rectangle_t r
         return;
     }
 
-    GL_Pixel_t *ddata = surface->data;
-
-    const int dwidth = surface->width;
+    GL_context_dirty(context, &drawing_region);
 
-    GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
+    GL_surface_fill(surface, &drawing_region, index);
+}
 
-    const int dskip = dwidth - width;
+static inline int floor_div(int a, int b) // `b` is positive.
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
 
-    for (int i = height; i; --i) {
-        for (int j = width; j; --j) {
-            *(dptr++) = index;
-        }
-        dptr += dskip;
-    }
+// Computes the triangle (clipped) bounding box, returning `false` when completely outside the clipping region.
+static inline bool triangle_region(const GL_Quad_t *clipping_region, GL_Point_t a, GL_Point_t b, GL_Point_t c, GL_Quad_t *drawing_region)
+{
+    *drawing_region = (GL_Quad_t){
+            .x0 = imax(imin(imin(a.x, b.x), c.x), clipping_region->x0),
+            .y0 = imax(imin(imin(a.y, b.y), c.y), clipping_region->y0),
+            .x1 = imin(imax(imax(a.x, b.x), c.x), clipping_region->x1),
+            .y1 = imin(imax(imax(a.y, b.y), c.y), clipping_region->y1)
+        };
+    return drawing_region->x0 <= drawing_region->x1 && drawing_region->y0 <= drawing_region->y1;
 }
 
+// A pixel is covered when the three (Pineda's) edge functions are non-negative, with the top-left fill convention
+// applied by biasing them. Since they are linear along the row, rather than evaluating them for every pixel of the
+// bounding box the covered span is found by solving each of them for its first/last non-negative pixel. The
+// triangle is convex, so the span is the intersection of the three solutions and is filled in a single run.
+//
 // http://www.sunshine2k.de/coding/java/TriangleRasterization/TriangleRasterization.html
 // https://www.scratchapixel.com/lessons/3d-basic-rendering/rasterization-practical-implementation/rasterization-stage
 // https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
 // https://github.com/dpethes/2D-rasterizer/blob/master/rasterizer2d.pas
+typedef struct _Edges_t {
+    int DX[3], DY[3];
+    int CY[3]; // Edge functions value at the left side of the current row.
+} Edges_t;
+
+// Returns `false` when the triangle degenerates to a point, which has no coverage.
+static inline bool edges_setup(Edges_t *edges, const GL_Quad_t *drawing_region, GL_Point_t a, GL_Point_t b, GL_Point_t c)
+{
+    if ((b.x - a.x) * (c.y - a.y) > (c.x - a.x) * (b.y - a.y)) { // Ensure CCW winding.
+        GL_Point_t t = a;
+        a = b;
+        b = t;
+    }
+
+    const GL_Point_t P[3] = { a, b, c };
+    const GL_Point_t Q[3] = { b, c, a };
+
+    for (int i = 0; i < 3; ++i) {
+        edges->DX[i] = P[i].x - Q[i].x;
+        edges->DY[i] = P[i].y - Q[i].y;
+    }
+
+    if (edges->DX[0] == 0 && edges->DY[0] == 0 && edges->DX[1] == 0 && edges->DY[1] == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        int C = edges->DY[i] * P[i].x - edges->DX[i] * P[i].y;
+        if ((edges->DY[i] < 0) || ((edges->DY[i] == 0) && (edges->DX[i] > 0))) {
+            C += 1;
+        }
+        edges->CY[i] = C + edges->DX[i] * drawing_region->y0 - edges->DY[i] * drawing_region->x0;
+    }
+
+    return true;
+}
+
+// Solves the current row span, in the `[0, width)` range relative to the region left side, and advances to the next
+// row. Returns `false` when the row is not covered.
+static inline bool edges_span(Edges_t *edges, int width, int *left, int *right)
+{
+    int l = 0;
+    int r = width - 1;
+    for (int i = 0; i < 3; ++i) { // Edge function is `CY - DY * x`, relative to the region left side.
+        const int DY = edges->DY[i];
+        const int CY = edges->CY[i];
+        if (DY > 0) {
+            r = imin(r, floor_div(CY, DY));
+        } else
+        if (DY < 0) {
+            l = imax(l, -floor_div(CY, -DY));
+        } else
+        if (CY < 0) {
+            r = -1; // Constant along the row, and negative.
+        }
+        edges->CY[i] += edges->DX[i];
+    }
+    *left = l;
+    *right = r;
+    return l <= r;
+}
+
+static void triangle(const GL_Surface_t *surface, const GL_Quad_t *drawing_region, GL_Point_t a, GL_Point_t b, GL_Point_t c, GL_Pixel_t index)
+{
+    Edges_t edges;
+    if (!edges_setup(&edges, drawing_region, a, b, c)) {
+        return;
+    }
+
+    const int x0 = drawing_region->x0;
+    const int y0 = drawing_region->y0;
+    const int width = drawing_region->x1 - x0 + 1;
+    const int height = drawing_region->y1 - y0 + 1;
+
+    const int dwidth = surface->width;
+    GL_Pixel_t *dptr = surface->data + y0 * dwidth + x0;
+
+    for (int y = 0; y < height; ++y) {
+        int left, right;
+        if (edges_span(&edges, width, &left, &right)) {
+            GL_span_fill(dptr + left, index, right - left + 1);
+        }
+        dptr += dwidth;
+    }
+}
+
 void GL_primitive_filled_triangle(const GL_Context_t *context, GL_Point_t a, GL_Point_t b, GL_Point_t c, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_FILLED_TRIANGLE,
+            .var.triangle = { .a = a, .b = b, .c = c, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -475,96 +644,214 @@ void GL_primitive_filled_triangle(const GL_Context_t *context, GL_Point_t a, GL_
         return;
     }
 
-    GL_Quad_t drawing_region = (GL_Quad_t){
-            .x0 = imin(imin(a.x, b.x), c.x),
-            .y0 = imin(imin(a.y, b.y), c.y),
-            .x1 = imax(imax(a.x, b.x), c.x),
-            .y1 = imax(imax(a.y, b.y), c.y)
-        };
-
-    if (drawing_region.x0 < clipping_region->x0) {
-        drawing_region.x0 = clipping_region->x0;
-    }
-    if (drawing_region.y0 < clipping_region->y0) {
-        drawing_region.y0 = clipping_region->y0;
-    }
-    if (drawing_region.x1 > clipping_region->x1) {
-        drawing_region.x1 = clipping_region->x1;
-    }
-    if (drawing_region.y1 > clipping_region->y1) {
-        drawing_region.y1 = clipping_region->y1;
+    GL_Quad_t drawing_region;
+    if (!triangle_region(clipping_region, a, b, c, &drawing_region)) { // Nothing to draw! Bail out!
+        return;
     }
 
-    const int width = drawing_region.x1 - drawing_region.x0 + 1;
-    const int height = drawing_region.y1 - drawing_region.y0 + 1;
-    if ((width <= 0) || (height <= 0)) { // Nothing to draw! Bail out!
+    GL_context_dirty(context, &drawing_region);
+
+    triangle(surface, &drawing_region, a, b, c, index);
+}
+
+// Draws `count / 3` triangles, whose vertices are consecutive in the array (i.e. a triangle list). The whole batch
+// is recorded as a single deferred command, and the state tables are resolved once.
+void GL_primitive_triangles(const GL_Context_t *context, const GL_Point_t *vertices, size_t count, GL_Pixel_t index)
+{
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_TRIANGLES,
+            .var.shape = { .vertices = vertices, .count = count, .index = index } })) {
         return;
     }
+#endif
 
-    if ((b.x - a.x) * (c.y - a.y) > (c.x - a.x) * (b.y - a.y)) { // Ensure CCW winding.
-        GL_Point_t t = a;
-        a = b;
-        b = t;
+    const GL_State_t *state = &context->state;
+    const GL_Quad_t *clipping_region = &state->clipping_region;
+    const GL_Pixel_t *shifting = state->shifting;
+    const GL_Bool_t *transparent = state->transparent;
+    const GL_Surface_t *surface = state->surface;
+
+    index = shifting[index];
+
+    if (transparent[index]) {
+        return;
     }
 
-    int DX12 = a.x - b.x;
-    int DX23 = b.x - c.x;
-    int DX31 = c.x - a.x;
-    int DY12 = a.y - b.y;
-    int DY23 = b.y - c.y;
-    int DY31 = c.y - a.y;
+    for (size_t i = 0; i + 2 < count; i += 3) {
+        const GL_Point_t a = vertices[i];
+        const GL_Point_t b = vertices[i + 1];
+        const GL_Point_t c = vertices[i + 2];
 
-    int C1 = DY12 * a.x - DX12 * a.y;
-    int C2 = DY23 * b.x - DX23 * b.y;
-    int C3 = DY31 * c.x - DX31 * c.y;
+        GL_Quad_t drawing_region;
+        if (!triangle_region(clipping_region, a, b, c, &drawing_region)) {
+            continue;
+        }
 
-    if ((DY12 < 0) || ((DY12 == 0) && (DX12 > 0))) { C1 += 1; }
-    if ((DY23 < 0) || ((DY23 == 0) && (DX23 > 0))) { C2 += 1; }
-    if ((DY31 < 0) || ((DY31 == 0) && (DX31 > 0))) { C3 += 1; }
+        GL_context_dirty(context, &drawing_region);
 
-    int CY1 = C1 + DX12 * drawing_region.y0 - DY12 * drawing_region.x0;
-    int CY2 = C2 + DX23 * drawing_region.y0 - DY23 * drawing_region.x0;
-    int CY3 = C3 + DX31 * drawing_region.y0 - DY31 * drawing_region.x0;
+        triangle(surface, &drawing_region, a, b, c, index);
+    }
+}
 
-    GL_Pixel_t *ddata = surface->data;
+static inline int clamp_texel(int64_t p, int64_t limit, int size)
+{
+    return p < 0 ? 0 : p >= limit ? size - 1 : (int)FIXED_FLOOR(p);
+}
 
-    const int dwidth = surface->width;
+// Affine texture mapping, with the texture coordinates stepped in fixed-point along the row. The gradients are
+// computed once per triangle, and the coordinates are evaluated from the vertices (not the clipped region) so that the
+// sampled texels don't depend on the clipping region, nor on the band the triangle is drawn in. As the vertices are
+// pixels (and the edges are drawn), the vertex texture coordinates are the texels drawn there and in-between ones
+// are rounded to the nearest, clamping to the source surface. The sampled span is drawn with `GL_span_blit()`, which
+// applies the shifting and transparency tables.
+static void textured_triangle(const GL_State_t *state, const GL_Quad_t *drawing_region, const GL_Surface_t *texture, GL_Vertex_t a, GL_Vertex_t b, GL_Vertex_t c)
+{
+    const int dx1 = b.x - a.x, dy1 = b.y - a.y;
+    const int dx2 = c.x - a.x, dy2 = c.y - a.y;
+    const float area = (float)(dx1 * dy2 - dx2 * dy1);
+    if (area == 0.0f) { // Degenerate, the mapping can't be defined.
+        return;
+    }
 
-    GL_Pixel_t *dptr = ddata + drawing_region.y0 * dwidth + drawing_region.x0;
+    Edges_t edges;
+    edges_setup(&edges, drawing_region, (GL_Point_t){ .x = a.x, .y = a.y }, (GL_Point_t){ .x = b.x, .y = b.y }, (GL_Point_t){ .x = c.x, .y = c.y });
 
-    const int dskip = dwidth;
+    const float du1 = b.u - a.u, du2 = c.u - a.u;
+    const float dv1 = b.v - a.v, dv2 = c.v - a.v;
+    const float dudx = (du1 * dy2 - du2 * dy1) / area;
+    const float dudy = (du2 * dx1 - du1 * dx2) / area;
+    const float dvdx = (dv1 * dy2 - dv2 * dy1) / area;
+    const float dvdy = (dv2 * dx1 - dv1 * dx2) / area;
+
+    const int32_t fdudx = (int32_t)FLOAT_TO_FIXED64(dudx);
+    const int32_t fdudy = (int32_t)FLOAT_TO_FIXED64(dudy);
+    const int32_t fdvdx = (int32_t)FLOAT_TO_FIXED64(dvdx);
+    const int32_t fdvdy = (int32_t)FLOAT_TO_FIXED64(dvdy);
+    const int64_t fua = FLOAT_TO_FIXED64(a.u + 0.5f); // Round to the nearest texel.
+    const int64_t fva = FLOAT_TO_FIXED64(a.v + 0.5f);
+
+    const int x0 = drawing_region->x0;
+    const int y0 = drawing_region->y0;
+    const int width = drawing_region->x1 - x0 + 1;
+    const int height = drawing_region->y1 - y0 + 1;
+
+    const GL_Surface_t *surface = state->surface;
+    const int dwidth = surface->width;
+    GL_Pixel_t *dptr = surface->data + y0 * dwidth + x0;
+
+    const GL_Pixel_t *sdata = texture->data;
+    const int swidth = (int)texture->width;
+    const int sheight = (int)texture->height;
+    const int64_t ulimit = (int64_t)swidth << FIXED_SHIFT;
+    const int64_t vlimit = (int64_t)sheight << FIXED_SHIFT;
+
+    for (int y = 0; y < height; ++y) {
+        int left, right;
+        if (!edges_span(&edges, width, &left, &right)) {
+            dptr += dwidth;
+            continue;
+        }
 
-    for (int y = 0; y <= height; ++y) { // Pinada's edge function is linear, we can cast it...
-        int CX1 = CY1;
-        int CX2 = CY2;
-        int CX3 = CY3;
-        int count = 0;
-        int eod = 0;
-        for (int x = 0; x <= width; ++x) {
-            if ((CX1 | CX2 | CX3) > 0) { // Check the sign bit only.
-                count += 1;
-                eod = x;
+        const int64_t fu = fua + (int64_t)(x0 + left - a.x) * fdudx + (int64_t)(y0 + y - a.y) * fdudy;
+        const int64_t fv = fva + (int64_t)(x0 + left - a.x) * fdvdx + (int64_t)(y0 + y - a.y) * fdvdy;
+        const int64_t fu_end = fu + (int64_t)(right - left) * fdudx; // Linear along the row, extremes are at the ends.
+        const int64_t fv_end = fv + (int64_t)(right - left) * fdvdx;
+
+        const bool inside = fu >= 0 && fu < ulimit && fu_end >= 0 && fu_end < ulimit
+            && fv >= 0 && fv < vlimit && fv_end >= 0 && fv_end < vlimit;
+
+        if (inside) { // The whole span samples the surface, step with no clamping.
+            int32_t su = (int32_t)fu;
+            int32_t sv = (int32_t)fv;
+            for (int x = left; x <= right; x += TEXTURED_SPAN_LENGTH) {
+                const int count = imin(right - x + 1, TEXTURED_SPAN_LENGTH);
+
+                GL_Pixel_t span[TEXTURED_SPAN_LENGTH];
+                for (int j = 0; j < count; ++j) {
+                    span[j] = sdata[FIXED_FLOOR(sv) * swidth + FIXED_FLOOR(su)];
+                    su += fdudx;
+                    sv += fdvdx;
+                }
+                GL_span_blit(dptr + x, span, (size_t)count, state);
+            }
+        } else {
+            int64_t su = fu;
+            int64_t sv = fv;
+            for (int x = left; x <= right; x += TEXTURED_SPAN_LENGTH) {
+                const int count = imin(right - x + 1, TEXTURED_SPAN_LENGTH);
+
+                GL_Pixel_t span[TEXTURED_SPAN_LENGTH];
+                for (int j = 0; j < count; ++j) {
+                    span[j] = sdata[clamp_texel(sv, vlimit, sheight) * swidth + clamp_texel(su, ulimit, swidth)];
+                    su += fdudx;
+                    sv += fdvdx;
+                }
+                GL_span_blit(dptr + x, span, (size_t)count, state);
             }
-            CX1 -= DY12;
-            CX2 -= DY23;
-            CX3 -= DY31;
         }
-        CY1 += DX12;
-        CY2 += DX23;
-        CY3 += DX31;
-
-        const int offset = eod - count;
-        dptr += eod;
-        for (int i = count; i; --i) { // Backward copy, simpler math.
-            *(dptr--) = index;
+
+        dptr += dwidth;
+    }
+}
+
+void GL_primitive_textured_triangle(const GL_Context_t *context, const GL_Surface_t *surface, GL_Vertex_t a, GL_Vertex_t b, GL_Vertex_t c)
+{
+    const GL_Vertex_t vertices[3] = { a, b, c };
+    GL_primitive_textured_triangles(context, surface, vertices, 3);
+}
+
+// The quad is split along the `a-c` diagonal, each half being mapped on its own (i.e. a non-parallelogram quad shows
+// the usual affine seam). The top-left convention guarantees the shared edge is drawn once.
+void GL_primitive_textured_quad(const GL_Context_t *context, const GL_Surface_t *surface, GL_Vertex_t a, GL_Vertex_t b, GL_Vertex_t c, GL_Vertex_t d)
+{
+    const GL_Vertex_t vertices[6] = { a, b, c, a, c, d };
+    GL_primitive_textured_triangles(context, surface, vertices, 6);
+}
+
+// Draws `count / 3` textured triangles (i.e. a triangle list), all of them sampling the same surface. As for the
+// flat-colored ones, the whole batch is recorded as a single deferred command.
+void GL_primitive_textured_triangles(const GL_Context_t *context, const GL_Surface_t *surface, const GL_Vertex_t *vertices, size_t count)
+{
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_TEXTURED_TRIANGLES,
+            .var.mesh = { .surface = surface, .vertices = vertices, .count = count } })) {
+        return;
+    }
+#endif
+
+    const GL_State_t *state = &context->state;
+    const GL_Quad_t *clipping_region = &state->clipping_region;
+
+    if (surface->width == 0 || surface->height == 0) { // Nothing to sample from.
+        return;
+    }
+
+    for (size_t i = 0; i + 2 < count; i += 3) {
+        const GL_Vertex_t a = vertices[i];
+        const GL_Vertex_t b = vertices[i + 1];
+        const GL_Vertex_t c = vertices[i + 2];
+
+        GL_Quad_t drawing_region;
+        if (!triangle_region(clipping_region, (GL_Point_t){ .x = a.x, .y = a.y }, (GL_Point_t){ .x = b.x, .y = b.y }, (GL_Point_t){ .x = c.x, .y = c.y }, &drawing_region)) {
+            continue;
         }
-        dptr += dskip - offset;
+
+        GL_context_dirty(context, &drawing_region);
+
+        textured_triangle(state, &drawing_region, surface, a, b, c);
     }
 }
 
 // https://www.javatpoint.com/computer-graphics-bresenhams-circle-algorithm
 void GL_primitive_filled_circle(const GL_Context_t *context, GL_Point_t center, int radius, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_FILLED_CIRCLE,
+            .var.primitive = { .position = center, .radius = radius, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -577,6 +864,8 @@ void GL_primitive_filled_circle(const GL_Context_t *context, GL_Point_t center,
         return;
     }
 
+    GL_context_dirty(context, &(GL_Quad_t){ .x0 = center.x - radius, .y0 = center.y - radius, .x1 = center.x + radius, .y1 = center.y + radius });
+
     const int cx = center.x;
     const int cy = center.y;
 
@@ -605,6 +894,13 @@ void GL_primitive_filled_circle(const GL_Context_t *context, GL_Point_t center,
 
 void GL_primitive_circle(const GL_Context_t *context, GL_Point_t center, int radius, GL_Pixel_t index)
 {
+#ifdef __GL_DEFERRED_SUPPORT__
+    if (context->deferred && GL_deferred_record(context, &(GL_Command_t){ .type = GL_COMMAND_CIRCLE,
+            .var.primitive = { .position = center, .radius = radius, .index = index } })) {
+        return;
+    }
+#endif
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -617,6 +913,8 @@ void GL_primitive_circle(const GL_Context_t *context, GL_Point_t center, int rad
         return;
     }
 
+    GL_context_dirty(context, &(GL_Quad_t){ .x0 = center.x - radius, .y0 = center.y - radius, .x1 = center.x + radius, .y1 = center.y + radius });
+
     const int cx = center.x;
     const int cy = center.y;
 
@@ -648,6 +946,8 @@ void GL_primitive_circle(const GL_Context_t *context, GL_Point_t center, int rad
 // https://lodev.org/cgtutor/floodfill.html
 void GL_context_fill(const GL_Context_t *context, GL_Point_t seed, GL_Pixel_t index)
 {
+    GL_context_flush(context); // Flood-filling reads back the surface, which needs to be up-to-date.
+
     const GL_State_t *state = &context->state;
     const GL_Quad_t *clipping_region = &state->clipping_region;
     const GL_Pixel_t *shifting = state->shifting;
@@ -658,6 +958,8 @@ void GL_context_fill(const GL_Context_t *context, GL_Point_t seed, GL_Pixel_t in
         return;
     }
 
+    GL_context_dirty(context, clipping_region); // Conservatively, the fill could spread up to the whole region.
+
     GL_Pixel_t *ddata = surface->data;
 
     const int dwidth = surface->width;
@@ -35,6 +35,10 @@ extern void GL_context_process(const GL_Context_t *context, GL_Rectangle_t recta
 
 extern void GL_primitive_filled_rectangle(const GL_Context_t *context, GL_Rectangle_t rectangle, GL_Pixel_t index);
 extern void GL_primitive_filled_triangle(const GL_Context_t *context, GL_Point_t a, GL_Point_t b, GL_Point_t c, GL_Pixel_t index);
+extern void GL_primitive_triangles(const GL_Context_t *context, const GL_Point_t *vertices, size_t count, GL_Pixel_t index);
+extern void GL_primitive_textured_triangle(const GL_Context_t *context, const GL_Surface_t *surface, GL_Vertex_t a, GL_Vertex_t b, GL_Vertex_t c);
+extern void GL_primitive_textured_quad(const GL_Context_t *context, const GL_Surface_t *surface, GL_Vertex_t a, GL_Vertex_t b, GL_Vertex_t c, GL_Vertex_t d);
+extern void GL_primitive_textured_triangles(const GL_Context_t *context, const GL_Surface_t *surface, const GL_Vertex_t *vertices, size_t count);
 extern void GL_primitive_filled_circle(const GL_Context_t *context, GL_Point_t center, int radius, GL_Pixel_t index);
 extern void GL_primitive_circle(const GL_Context_t *context, GL_Point_t center, int radius, GL_Pixel_t index);
 
@@ -28,9 +28,12 @@
 #include <libs/stb.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #define LOG_CONTEXT "sheet"
 
+#define IS_TRANSPARENT(b, i)    ((b)[(i) / 32] & ((uint32_t)1 << ((i) % 32)))
+
 GL_Rectangle_t *precompute_cells(size_t width, size_t height, size_t cell_width, size_t cell_height)
 {
     size_t columns = width / cell_width;
@@ -53,6 +56,17 @@ GL_Rectangle_t *precompute_cells(size_t width, size_t height, size_t cell_width,
     return cells;
 }
 
+static void discard_runs(GL_Sheet_t *sheet)
+{
+    size_t count = arrlen(sheet->runs);
+    for (size_t i = 0; i < count; ++i) {
+        arrfree(sheet->runs[i]->offsets);
+        arrfree(sheet->runs[i]->data);
+        free(sheet->runs[i]);
+    }
+    arrfree(sheet->runs);
+}
+
 bool GL_sheet_decode(GL_Sheet_t *sheet, const void *buffer, size_t size, size_t cell_width, size_t cell_height, GL_Surface_Callback_t callback, void *user_data)
 {
     GL_Surface_t atlas;
@@ -87,6 +101,7 @@ void GL_sheet_attach(GL_Sheet_t *sheet, const GL_Surface_t *atlas, size_t cell_w
     *sheet = (GL_Sheet_t){
             .atlas = *atlas,
             .cells = precompute_cells(atlas->width, atlas->height, cell_width, cell_height),
+            .count = (atlas->width / cell_width) * (atlas->height / cell_height),
             .size = (GL_Size_t){ cell_width, cell_height }
         };
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p attached", sheet);
@@ -94,6 +109,202 @@ void GL_sheet_attach(GL_Sheet_t *sheet, const GL_Surface_t *atlas, size_t cell_w
 
 void GL_sheet_detach(GL_Sheet_t *sheet)
 {
+    discard_runs(sheet);
+    free(sheet->trims.areas);
+    free(sheet->trims.offsets);
     free(sheet->cells);
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p detached", sheet);
 }
+
+// Precompute, for each cell, the opaque runs of pixels so that the blitter can copy them without testing every
+// pixel for transparency. The runs are built once for each transparency, and looked-up on later calls.
+const GL_Sheet_Runs_t *GL_sheet_compile(GL_Sheet_t *sheet, const GL_Transparency_t *transparency)
+{
+    size_t variants = arrlen(sheet->runs);
+    for (size_t i = 0; i < variants; ++i) {
+        if (memcmp(&sheet->runs[i]->transparency, transparency, sizeof(GL_Transparency_t)) == 0) {
+            return sheet->runs[i];
+        }
+    }
+    if (variants == GL_SHEET_MAX_RUNS) {
+        return NULL;
+    }
+
+    GL_Sheet_Runs_t *runs = malloc(sizeof(GL_Sheet_Runs_t));
+    if (!runs) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate runs for sheet %p", sheet);
+        return NULL;
+    }
+
+    const uint32_t *bits = transparency->bits;
+
+    const GL_Surface_t *atlas = &sheet->atlas;
+    const size_t count = sheet->count;
+
+    size_t *offsets = NULL;
+    uint16_t *data = NULL;
+    for (size_t i = 0; i < count; ++i) {
+        const GL_Rectangle_t *cell = &sheet->cells[i];
+
+        arrpush(offsets, arrlen(data));
+
+        const GL_Pixel_t *sptr = atlas->data + cell->y * atlas->width + cell->x;
+        for (size_t y = 0; y < cell->height; ++y) {
+            const size_t header = arrlen(data);
+            arrpush(data, 0);
+            for (size_t x = 0; x < cell->width; ) {
+                if (IS_TRANSPARENT(bits, sptr[x])) {
+                    ++x;
+                    continue;
+                }
+                const size_t start = x;
+                while (x < cell->width && !IS_TRANSPARENT(bits, sptr[x])) {
+                    ++x;
+                }
+                arrpush(data, (uint16_t)start);
+                arrpush(data, (uint16_t)(x - start));
+                data[header] += 1;
+            }
+            sptr += atlas->width;
+        }
+    }
+
+    *runs = (GL_Sheet_Runs_t){
+            .transparency = *transparency,
+            .offsets = offsets,
+            .data = data
+        };
+    arrpush(sheet->runs, runs);
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p compiled (#%d), %d cells w/ %d run entries", sheet, variants, count, arrlen(data));
+
+    return runs;
+}
+
+// Rearrange the atlas as a single column of cells, so that each cell occupies a contiguous block of memory (with
+// the cell width as stride) and a small blit touches far fewer cache lines than the original (wide) image. The
+// atlas needs to be owned by the sheet, as it is replaced.
+bool GL_sheet_repack(GL_Sheet_t *sheet)
+{
+    const GL_Surface_t *atlas = &sheet->atlas;
+    const size_t cell_width = sheet->size.width;
+    const size_t cell_height = sheet->size.height;
+    const size_t count = sheet->count;
+
+    if (atlas->width == cell_width) {
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p is already packed", sheet);
+        return true;
+    }
+
+    GL_Surface_t packed;
+    if (!GL_surface_create(&packed, cell_width, cell_height * count)) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't create packed atlas for sheet %p", sheet);
+        return false;
+    }
+
+    GL_Pixel_t *dptr = packed.data;
+    for (size_t i = 0; i < count; ++i) {
+        GL_Rectangle_t *cell = &sheet->cells[i];
+        const GL_Pixel_t *sptr = atlas->data + cell->y * atlas->width + cell->x;
+        for (size_t y = 0; y < cell_height; ++y) {
+            memcpy(dptr, sptr, cell_width);
+            dptr += cell_width;
+            sptr += atlas->width;
+        }
+        *cell = (GL_Rectangle_t){ .x = 0, .y = (int)(i * cell_height), .width = cell_width, .height = cell_height };
+    }
+
+    GL_surface_delete(&sheet->atlas);
+    sheet->atlas = packed;
+
+    discard_runs(sheet); // Derived data refers to the previous layout, discard it.
+    free(sheet->trims.areas);
+    free(sheet->trims.offsets);
+    sheet->trims = (GL_Sheet_Trims_t){ 0 };
+
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p repacked, %d cells (%dx%d)", sheet, count, cell_width, cell_height);
+    return true;
+}
+
+static inline bool is_empty(const GL_Pixel_t *sptr, size_t length, size_t stride, const uint32_t *bits)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (!IS_TRANSPARENT(bits, *sptr)) {
+            return false;
+        }
+        sptr += stride;
+    }
+    return true;
+}
+
+// Compute, for each cell, the smallest area enclosing its non-transparent pixels. Fully transparent cells are
+// trimmed to an empty area. Meant to be called once the atlas is loaded (any previous trims are replaced).
+bool GL_sheet_trim(GL_Sheet_t *sheet, const GL_Transparency_t *transparency)
+{
+    GL_Sheet_Trims_t *trims = &sheet->trims;
+
+    const uint32_t *bits = transparency->bits;
+
+    const GL_Surface_t *atlas = &sheet->atlas;
+    const size_t stride = atlas->width;
+    const size_t count = sheet->count;
+
+    GL_Rectangle_t *areas = trims->areas ? trims->areas : malloc(count * sizeof(GL_Rectangle_t));
+    GL_Point_t *offsets = trims->offsets ? trims->offsets : malloc(count * sizeof(GL_Point_t));
+    if (!areas || !offsets) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate trims for sheet %p", sheet);
+        free(areas);
+        free(offsets);
+        *trims = (GL_Sheet_Trims_t){ 0 };
+        return false;
+    }
+
+    size_t trimmed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const GL_Rectangle_t *cell = &sheet->cells[i];
+        const GL_Pixel_t *origin = atlas->data + cell->y * stride + cell->x;
+
+        size_t top = 0, bottom = cell->height;
+        while (top < bottom && is_empty(origin + top * stride, cell->width, 1, bits)) {
+            ++top;
+        }
+        while (bottom > top && is_empty(origin + (bottom - 1) * stride, cell->width, 1, bits)) {
+            --bottom;
+        }
+
+        size_t left = 0, right = cell->width;
+        const size_t height = bottom - top;
+        if (height > 0) {
+            while (left < right && is_empty(origin + top * stride + left, height, stride, bits)) {
+                ++left;
+            }
+            while (right > left && is_empty(origin + top * stride + right - 1, height, stride, bits)) {
+                --right;
+            }
+        } else {
+            right = left; // Nothing to draw.
+        }
+
+        areas[i] = (GL_Rectangle_t){ .x = cell->x + (int)left, .y = cell->y + (int)top, .width = right - left, .height = height };
+        offsets[i] = (GL_Point_t){ .x = (int)left, .y = (int)top };
+
+        trimmed += (cell->width * cell->height) - (areas[i].width * areas[i].height);
+    }
+
+    *trims = (GL_Sheet_Trims_t){
+            .transparency = *transparency,
+            .areas = areas,
+            .offsets = offsets
+        };
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "sheet %p trimmed, %d cells w/ %d pixels less", sheet, count, trimmed);
+    return true;
+}
+
+// Trims are used only when the transparency matches, otherwise the cells need to be drawn whole.
+const GL_Sheet_Trims_t *GL_sheet_trims(const GL_Sheet_t *sheet, const GL_Transparency_t *transparency)
+{
+    const GL_Sheet_Trims_t *trims = &sheet->trims;
+    if (!trims->areas || memcmp(&trims->transparency, transparency, sizeof(GL_Transparency_t)) != 0) {
+        return NULL;
+    }
+    return trims;
+}
@@ -26,12 +26,36 @@
 #include <stdbool.h>
 
 #include "common.h"
+#include "context.h"
 #include "surface.h"
 
+// Each compiled cell is stored, row by row, as the count of its opaque runs followed by the `(offset, length)`
+// pairs of each run. Since opacity depends on the state tables, the runs are valid only for the transparency they
+// have been built upon. The sheet keeps a set of them, one for each (distinct) transparency it's drawn with.
+typedef struct _GL_Sheet_Runs_t {
+    GL_Transparency_t transparency;
+    size_t *offsets; // Index of the first entry of each cell into `data`.
+    uint16_t *data;
+} GL_Sheet_Runs_t;
+
+#define GL_SHEET_MAX_RUNS   8 // Beyond this amount, uncommon transparencies are drawn w/o runs.
+
+// The trimmed area of each cell excludes the (transparent) empty borders, and needs to be drawn at the
+// given offset from the cell origin. As for the runs, they are valid only for the transparency they are built
+// upon. They are computed once, when loading, and ignored when drawing with a different transparency.
+typedef struct _GL_Sheet_Trims_t {
+    GL_Transparency_t transparency;
+    GL_Rectangle_t *areas;
+    GL_Point_t *offsets;
+} GL_Sheet_Trims_t;
+
 typedef struct _GL_Sheet_t {
     GL_Surface_t atlas;
     GL_Rectangle_t *cells;
+    size_t count;
     GL_Size_t size;
+    GL_Sheet_Runs_t **runs; // Allocated one by one, as they are referenced by the deferred commands.
+    GL_Sheet_Trims_t trims;
 } GL_Sheet_t;
 
 // TODO: is the GL_Sheet_t really needed?
@@ -41,6 +65,10 @@ extern bool GL_sheet_fetch(GL_Sheet_t *sheet, GL_Image_t image, size_t cell_widt
 extern void GL_sheet_delete(GL_Sheet_t *sheet);
 extern void GL_sheet_attach(GL_Sheet_t *sheet, const GL_Surface_t *atlas, size_t cell_width, size_t cell_height);
 extern void GL_sheet_detach(GL_Sheet_t *sheet);
+extern const GL_Sheet_Runs_t *GL_sheet_compile(GL_Sheet_t *sheet, const GL_Transparency_t *transparency);
+extern bool GL_sheet_repack(GL_Sheet_t *sheet);
+extern bool GL_sheet_trim(GL_Sheet_t *sheet, const GL_Transparency_t *transparency);
+extern const GL_Sheet_Trims_t *GL_sheet_trims(const GL_Sheet_t *sheet, const GL_Transparency_t *transparency);
 
 
 #endif  /* __GL_SHEET_H__ */
\ No newline at end of file
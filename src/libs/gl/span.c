@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#include "span.h"
+
+#include <config.h>
+#include <libs/cpu.h>
+#include <libs/log.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GL_SIMD_SUPPORT__)
+  #if defined(__i386__) || defined(__x86_64__)
+    #include <immintrin.h>
+
+    #define __SPAN_X86__
+  #endif
+#endif
+
+#define LOG_CONTEXT "gl"
+
+typedef void (*Span_Kernel_t)(GL_Pixel_t *destination, const GL_Pixel_t *source, size_t count, const GL_Pixel_t *shifting, const GL_Bool_t *transparent, GL_Pixel_t key);
+typedef void (*Span_Expand_t)(GL_Color_t *destination, const GL_Pixel_t *source, size_t count, const GL_Color_t *colors);
+typedef void (*Span_Fill_t)(GL_Pixel_t *destination, GL_Pixel_t value, size_t count);
+
+// Fills larger than this are (likely) to exceed the cache size, and are streamed to memory bypassing it.
+#define STREAM_THRESHOLD    (256 * 1024)
+
+#define FETCH_IDENTITY(p)   (p)
+#define FETCH_SHIFTING(p)   shifting[(p)]
+
+#define SKIP_NONE(i)        false
+#define SKIP_KEY(i)         ((i) == key)
+#define SKIP_TABLE(i)       transparent[(i)]
+
+// The scalar kernels family, one for each combination of (non-trivial) state tables. The compiler is able to
+// optimize away the unneeded look-ups and tests.
+#define SPAN_KERNEL(name, fetch, skip) \
+    static void name(GL_Pixel_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Pixel_t *shifting, const GL_Bool_t *transparent, GL_Pixel_t key) \
+    { \
+        for (size_t i = count; i; --i) { \
+            GL_Pixel_t index = fetch(*(sptr++)); \
+            if (skip(index)) { \
+                dptr++; \
+            } else { \
+                *(dptr++) = index; \
+            } \
+        } \
+    }
+
+SPAN_KERNEL(_blit_scalar, FETCH_SHIFTING, SKIP_TABLE)
+SPAN_KERNEL(_blit_shifting_key, FETCH_SHIFTING, SKIP_KEY)
+SPAN_KERNEL(_blit_shifting_opaque, FETCH_SHIFTING, SKIP_NONE)
+SPAN_KERNEL(_blit_identity_table, FETCH_IDENTITY, SKIP_TABLE)
+SPAN_KERNEL(_blit_identity_key, FETCH_IDENTITY, SKIP_KEY)
+
+static void _expand_scalar(GL_Color_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Color_t *colors)
+{
+    for (size_t i = count; i; --i) {
+        *(dptr++) = colors[*(sptr++)];
+    }
+}
+
+static void _fill_memset(GL_Pixel_t *dptr, GL_Pixel_t value, size_t count)
+{
+    memset(dptr, value, count);
+}
+
+#if defined(__SPAN_X86__)
+// Plain SSE2 lacks a byte-shuffle instruction, so the two table lookups are still scalar. The gain comes from the
+// branch-less masked store, which doesn't suffer from mispredictions along the (irregular) sprite borders.
+__attribute__((target("sse2")))
+static void _blit_sse2(GL_Pixel_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Pixel_t *shifting, const GL_Bool_t *transparent, GL_Pixel_t key)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; count >= 16; count -= 16) {
+        GL_Pixel_t indexes[16];
+        GL_Bool_t flags[16];
+        for (int i = 0; i < 16; ++i) {
+            const GL_Pixel_t index = shifting[sptr[i]];
+            indexes[i] = index;
+            flags[i] = transparent[index];
+        }
+
+        const __m128i index = _mm_loadu_si128((const __m128i *)indexes);
+        const __m128i opaque = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)flags), zero);
+        const __m128i pixels = _mm_loadu_si128((const __m128i *)dptr);
+        _mm_storeu_si128((__m128i *)dptr, _mm_or_si128(_mm_and_si128(opaque, index), _mm_andnot_si128(opaque, pixels)));
+
+        sptr += 16;
+        dptr += 16;
+    }
+
+    _blit_scalar(dptr, sptr, count, shifting, transparent, key);
+}
+
+// With identity shifting and a single transparent index, the kernel is a plain compare-and-blend.
+__attribute__((target("sse2")))
+static void _blit_key_sse2(GL_Pixel_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Pixel_t *shifting, const GL_Bool_t *transparent, GL_Pixel_t key)
+{
+    const __m128i keys = _mm_set1_epi8((char)key);
+
+    for (; count >= 16; count -= 16) {
+        const __m128i index = _mm_loadu_si128((const __m128i *)sptr);
+        const __m128i skip = _mm_cmpeq_epi8(index, keys);
+        const __m128i pixels = _mm_loadu_si128((const __m128i *)dptr);
+        _mm_storeu_si128((__m128i *)dptr, _mm_or_si128(_mm_and_si128(skip, pixels), _mm_andnot_si128(skip, index)));
+
+        sptr += 16;
+        dptr += 16;
+    }
+
+    _blit_identity_key(dptr, sptr, count, shifting, transparent, key);
+}
+
+// A 256-entries table is looked-up as sixteen 16-entries sub-tables, one for each value of the index high nibble.
+// The shuffle instruction resolves the low nibble, and the result is kept only for the lanes whose high nibble
+// matches the current sub-table.
+__attribute__((target("avx2")))
+static inline __m256i _lookup_avx2(const void *table, __m256i indexes)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i lo = _mm256_and_si256(indexes, nibble);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(indexes, 4), nibble);
+
+    const __m128i *entries = (const __m128i *)table;
+
+    __m256i result = _mm256_setzero_si256();
+    for (int k = 0; k < 16; ++k) {
+        const __m256i values = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(entries + k)), lo);
+        const __m256i selected = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8((char)k));
+        result = _mm256_or_si256(result, _mm256_and_si256(selected, values));
+    }
+    return result;
+}
+
+__attribute__((target("avx2")))
+static inline __m128i _lookup_ssse3(const void *table, __m128i indexes)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i lo = _mm_and_si128(indexes, nibble);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi16(indexes, 4), nibble);
+
+    const __m128i *entries = (const __m128i *)table;
+
+    __m128i result = _mm_setzero_si128();
+    for (int k = 0; k < 16; ++k) {
+        const __m128i values = _mm_shuffle_epi8(_mm_loadu_si128(entries + k), lo);
+        const __m128i selected = _mm_cmpeq_epi8(hi, _mm_set1_epi8((char)k));
+        result = _mm_or_si128(result, _mm_and_si128(selected, values));
+    }
+    return result;
+}
+
+__attribute__((target("avx2")))
+static void _blit_avx2(GL_Pixel_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Pixel_t *shifting, const GL_Bool_t *transparent, GL_Pixel_t key)
+{
+    for (; count >= 32; count -= 32) {
+        const __m256i index = _lookup_avx2(shifting, _mm256_loadu_si256((const __m256i *)sptr));
+        const __m256i opaque = _mm256_cmpeq_epi8(_lookup_avx2(transparent, index), _mm256_setzero_si256());
+        const __m256i pixels = _mm256_loadu_si256((const __m256i *)dptr);
+        _mm256_storeu_si256((__m256i *)dptr, _mm256_blendv_epi8(pixels, index, opaque));
+
+        sptr += 32;
+        dptr += 32;
+    }
+
+    if (count >= 16) { // Half-width step, small sprites are often less than 32 pixels wide.
+        const __m128i index = _lookup_ssse3(shifting, _mm_loadu_si128((const __m128i *)sptr));
+        const __m128i opaque = _mm_cmpeq_epi8(_lookup_ssse3(transparent, index), _mm_setzero_si128());
+        const __m128i pixels = _mm_loadu_si128((const __m128i *)dptr);
+        _mm_storeu_si128((__m128i *)dptr, _mm_blendv_epi8(pixels, index, opaque));
+
+        sptr += 16;
+        dptr += 16;
+        count -= 16;
+    }
+
+    _blit_scalar(dptr, sptr, count, shifting, transparent, key);
+}
+
+__attribute__((target("avx2")))
+static void _blit_key_avx2(GL_Pixel_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Pixel_t *shifting, const GL_Bool_t *transparent, GL_Pixel_t key)
+{
+    const __m256i keys = _mm256_set1_epi8((char)key);
+
+    for (; count >= 32; count -= 32) {
+        const __m256i index = _mm256_loadu_si256((const __m256i *)sptr);
+        const __m256i skip = _mm256_cmpeq_epi8(index, keys);
+        const __m256i pixels = _mm256_loadu_si256((const __m256i *)dptr);
+        _mm256_storeu_si256((__m256i *)dptr, _mm256_blendv_epi8(index, pixels, skip));
+
+        sptr += 32;
+        dptr += 32;
+    }
+
+    _blit_key_sse2(dptr, sptr, count, shifting, transparent, key);
+}
+
+// Non-temporal stores need a 16-bytes aligned destination, the unaligned head and tail are filled in the usual way.
+// The final fence ensures the (weakly ordered) streamed data is visible to the other threads.
+__attribute__((target("sse2")))
+static void _fill_stream_sse2(GL_Pixel_t *dptr, GL_Pixel_t value, size_t count)
+{
+    if (count < STREAM_THRESHOLD) {
+        memset(dptr, value, count);
+        return;
+    }
+
+    const size_t head = (16 - ((uintptr_t)dptr & 15)) & 15;
+    memset(dptr, value, head);
+    dptr += head;
+    count -= head;
+
+    const __m128i values = _mm_set1_epi8((char)value);
+    for (; count >= 64; count -= 64) {
+        _mm_stream_si128((__m128i *)dptr, values);
+        _mm_stream_si128((__m128i *)(dptr + 16), values);
+        _mm_stream_si128((__m128i *)(dptr + 32), values);
+        _mm_stream_si128((__m128i *)(dptr + 48), values);
+        dptr += 64;
+    }
+    _mm_sfence();
+
+    memset(dptr, value, count);
+}
+
+// Colors are 32-bits wide, too large to be shuffled from registers. The gather instruction fetches eight of
+// them at once, with the indexes zero-extended to 32-bits.
+__attribute__((target("avx2")))
+static void _expand_avx2(GL_Color_t *dptr, const GL_Pixel_t *sptr, size_t count, const GL_Color_t *colors)
+{
+    const int *table = (const int *)colors;
+
+    for (; count >= 16; count -= 16) {
+        const __m128i indexes = _mm_loadu_si128((const __m128i *)sptr);
+        const __m256i lo = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(indexes), sizeof(GL_Color_t));
+        const __m256i hi = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(indexes, 8)), sizeof(GL_Color_t));
+        _mm256_storeu_si256((__m256i *)dptr, lo);
+        _mm256_storeu_si256((__m256i *)(dptr + 8), hi);
+
+        sptr += 16;
+        dptr += 16;
+    }
+
+    _expand_scalar(dptr, sptr, count, colors);
+}
+#endif
+
+static Span_Kernel_t _blit = _blit_scalar;
+static Span_Kernel_t _blit_key = _blit_identity_key;
+static Span_Expand_t _expand = _expand_scalar;
+static Span_Fill_t _fill = _fill_memset;
+
+void GL_span_initialize(void)
+{
+    const int features = cpu_features();
+#if defined(__SPAN_X86__)
+    _fill = (features & CPU_FEATURE_SSE2) ? _fill_stream_sse2 : _fill_memset; // Orthogonal to the other kernels.
+    if (features & CPU_FEATURE_AVX2) {
+        _blit = _blit_avx2;
+        _blit_key = _blit_key_avx2;
+        _expand = _expand_avx2;
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "using AVX2 span kernels");
+        return;
+    }
+    if (features & CPU_FEATURE_SSE2) {
+        _blit = _blit_sse2;
+        _blit_key = _blit_key_sse2;
+        _expand = _expand_scalar;
+        Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "using SSE2 span kernels");
+        return;
+    }
+#endif
+    _blit = _blit_scalar;
+    _blit_key = _blit_identity_key;
+    _expand = _expand_scalar;
+    Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "using scalar span kernels (features %04x)", features);
+}
+
+// The kernel is selected upon the state tables flags, so that trivial tables are neither looked-up nor tested.
+// In-place processing (i.e. same source and destination) is supported.
+void GL_span_blit(GL_Pixel_t *destination, const GL_Pixel_t *source, size_t count, const GL_State_t *state)
+{
+    const GL_Pixel_t *shifting = state->shifting;
+    const GL_Bool_t *transparent = state->transparent;
+    const GL_Pixel_t key = state->transparent_key;
+    const int flags = state->tables_flags;
+
+    if (destination != source && destination < source + count && source < destination + count) { // Overlapping spans (self-blit) are processed pixel-by-pixel.
+        _blit_scalar(destination, source, count, shifting, transparent, key);
+        return;
+    }
+
+    if (flags & GL_TABLES_IDENTITY) {
+        if (destination == source) { // In-place processing with identity shifting, nothing to do.
+            return;
+        }
+        if (flags & GL_TABLES_OPAQUE) {
+            memcpy(destination, source, count);
+        } else
+        if (flags & GL_TABLES_SINGLE_TRANSPARENT) {
+            _blit_key(destination, source, count, shifting, transparent, key);
+        } else {
+            _blit_identity_table(destination, source, count, shifting, transparent, key);
+        }
+    } else {
+        if (flags & GL_TABLES_OPAQUE) {
+            _blit_shifting_opaque(destination, source, count, shifting, transparent, key);
+        } else
+        if (flags & GL_TABLES_SINGLE_TRANSPARENT) {
+            _blit_shifting_key(destination, source, count, shifting, transparent, key);
+        } else {
+            _blit(destination, source, count, shifting, transparent, key);
+        }
+    }
+}
+
+// Expand `count` indexes to their palette colors (e.g. to upload the buffer as an RGBA texture).
+void GL_span_expand(GL_Color_t *destination, const GL_Pixel_t *source, size_t count, const GL_Color_t *colors)
+{
+    _expand(destination, source, count, colors);
+}
+
+// Fill `count` pixels with the same value. Large fills (i.e. whole buffer clears) are streamed, when supported.
+void GL_span_fill(GL_Pixel_t *destination, GL_Pixel_t value, size_t count)
+{
+    _fill(destination, value, count);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#ifndef __GL_SPAN_H__
+#define __GL_SPAN_H__
+
+#include "common.h"
+#include "context.h"
+#include "palette.h"
+
+extern void GL_span_initialize(void);
+
+extern void GL_span_blit(GL_Pixel_t *destination, const GL_Pixel_t *source, size_t count, const GL_State_t *state);
+extern void GL_span_fill(GL_Pixel_t *destination, GL_Pixel_t value, size_t count);
+extern void GL_span_expand(GL_Color_t *destination, const GL_Pixel_t *source, size_t count, const GL_Color_t *colors);
+
+#endif  /* __GL_SPAN_H__ */
@@ -27,6 +27,8 @@
 #include <libs/gl/gl.h>
 #include <libs/stb.h>
 
+#include "span.h"
+
 #define LOG_CONTEXT "gl"
 
 bool GL_surface_decode(GL_Surface_t *surface, const void *buffer, size_t buffer_size, const GL_Surface_Callback_t callback, void *user_data)
@@ -39,7 +41,7 @@ bool GL_surface_decode(GL_Surface_t *surface, const void *buffer, size_t buffer_
     }
     GL_surface_create(surface, width, height);
     if (callback != NULL) {
-        callback(user_data, surface, data);
+        callback(user_data, surface, &(GL_Image_t){ .width = width, .height = height, .data = data });
     }
     stbi_image_free(data);
 
@@ -56,7 +58,7 @@ bool GL_surface_fetch(GL_Surface_t *surface, GL_Image_t image, const GL_Surface_
     }
 
     if (callback != NULL) {
-        callback(user_data, surface, image.data);
+        callback(user_data, surface, &image);
     }
 
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "surface fetched at %p (%dx%d)", surface->data, image.width, image.height);
@@ -89,28 +91,52 @@ void GL_surface_delete(GL_Surface_t *surface)
     Log_write(LOG_LEVELS_DEBUG, LOG_CONTEXT, "surface at %p deleted", surface->data);
 }
 
+// Fill the (already clipped) area with the given index. Full-width areas are contiguous, and filled in one go.
+void GL_surface_fill(const GL_Surface_t *surface, const GL_Quad_t *area, GL_Pixel_t index)
+{
+    const size_t swidth = surface->width;
+    const size_t width = area->x1 - area->x0 + 1;
+    const size_t height = area->y1 - area->y0 + 1;
+
+    GL_Pixel_t *dptr = surface->data + area->y0 * swidth + area->x0;
+
+    if (width == swidth) {
+        GL_span_fill(dptr, index, width * height);
+        return;
+    }
+
+    for (size_t i = height; i; --i) {
+        GL_span_fill(dptr, index, width);
+        dptr += swidth;
+    }
+}
+
 void GL_surface_to_rgba(const GL_Surface_t *surface, const GL_Palette_t *palette, GL_Color_t *vram)
 {
-    const int data_size = surface->data_size;
+    GL_surface_to_rgba_rows(surface, palette, vram, 0, surface->height);
+}
+
+// Convert only the `[first, first + count)` rows, leaving the others in the VRAM buffer untouched.
+void GL_surface_to_rgba_rows(const GL_Surface_t *surface, const GL_Palette_t *palette, GL_Color_t *vram, size_t first, size_t count)
+{
+    const int data_size = surface->width * count;
     const GL_Color_t *colors = palette->colors;
+    const GL_Pixel_t *src = surface->data + first * surface->width;
+    GL_Color_t *dst = vram + first * surface->width;
 #ifdef __DEBUG_GRAPHICS__
-    int count = palette->count;
-#endif
-    const GL_Pixel_t *src = surface->data;
-    GL_Color_t *dst = vram;
+    int palette_count = palette->count;
     for (int i = data_size; i; --i) {
         GL_Pixel_t index = *src++;
-#ifdef __DEBUG_GRAPHICS__
         GL_Color_t color;
-        if (index >= count) {
+        if (index >= palette_count) {
             int y = (index - 240) * 8;
             color = (GL_Color_t){ 0, 63 + y, 0, 255 };
         } else {
             color = colors[index];
         }
         *(dst++) = color;
+    }
 #else
-        *(dst++) = colors[index];
+    GL_span_expand(dst, src, data_size, colors); // Rows are contiguous, expand them in a single run.
 #endif
-    }
 }
@@ -34,13 +34,16 @@ typedef struct _GL_Surface_t {
     size_t data_size;
 } GL_Surface_t;
 
-typedef void (*GL_Surface_Callback_t)(void *user_data, GL_Surface_t *surface, const void *data);
+typedef void (*GL_Surface_Callback_t)(void *user_data, GL_Surface_t *surface, const GL_Image_t *image);
 
 extern bool GL_surface_decode(GL_Surface_t *surface, const void *buffer, size_t buffer_size, const GL_Surface_Callback_t callback, void *user_data);
 extern bool GL_surface_fetch(GL_Surface_t *surface, GL_Image_t image, const GL_Surface_Callback_t callback, void *user_data);
 extern bool GL_surface_create(GL_Surface_t *surface, size_t width, size_t height);
 extern void GL_surface_delete(GL_Surface_t *surface);
 
+extern void GL_surface_fill(const GL_Surface_t *surface, const GL_Quad_t *area, GL_Pixel_t index);
+
 extern void GL_surface_to_rgba(const GL_Surface_t *context, const GL_Palette_t *palette, GL_Color_t *vram);
+extern void GL_surface_to_rgba_rows(const GL_Surface_t *surface, const GL_Palette_t *palette, GL_Color_t *vram, size_t first, size_t count);
 
 #endif  /* __GL_SURFACE_H__ */
\ No newline at end of file
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#include "xform.h"
+
+#include <libs/log.h>
+
+#include <math.h>
+#include <stdlib.h>
+
+#define LOG_CONTEXT "gl"
+
+// The table entries are "scattered" into their scan-lines first, then each register value is carried over to the
+// following ones. This way the entries can be given in any order, and the blitter doesn't need to interpret them.
+// Entries at or beyond `height` are never reached by the blitter and are ignored, so that the table size is bound
+// by the target rather than by the (possibly sparse) entry indexes.
+bool GL_xform_table_compile(GL_XForm_t *xform, const GL_XForm_Table_Entry_t *entries, size_t count, size_t height)
+{
+    GL_xform_table_clear(xform);
+
+    int last = -1;
+    for (size_t i = 0; i < count; ++i) {
+        const int scan_line = entries[i].scan_line;
+        if (scan_line >= 0 && (size_t)scan_line >= height) {
+            Log_write(LOG_LEVELS_WARNING, LOG_CONTEXT, "scan-line #%d is out of range, ignored", scan_line);
+            continue;
+        }
+        if (scan_line > last) {
+            last = scan_line;
+        }
+    }
+    if (last < 0) { // Empty table, or made of end-of-data markers only.
+        return true;
+    }
+
+    const size_t scan_lines = (size_t)last + 1;
+    GL_XForm_Scan_Line_t *table = calloc(scan_lines, sizeof(GL_XForm_Scan_Line_t));
+    if (!table) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate %d scan-lines table", scan_lines);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const GL_XForm_Table_Entry_t *entry = &entries[i];
+        if (entry->scan_line < 0 || entry->scan_line > last) {
+            continue;
+        }
+        GL_XForm_Scan_Line_t *scan_line = &table[entry->scan_line];
+        for (size_t k = 0; k < entry->count; ++k) {
+            const GL_XForm_Registers_t id = entry->operations[k].id;
+            if ((size_t)id >= GL_XForm_Registers_t_CountOf) {
+                continue;
+            }
+            scan_line->registers[id] = entry->operations[k].value;
+            scan_line->mask |= 1u << id;
+        }
+    }
+
+    for (int i = 1; i <= last; ++i) {
+        const GL_XForm_Scan_Line_t *previous = &table[i - 1];
+        GL_XForm_Scan_Line_t *current = &table[i];
+        for (int id = GL_XForm_Registers_t_First; id < GL_XForm_Registers_t_CountOf; ++id) {
+            const uint32_t bit = 1u << id;
+            if ((previous->mask & bit) && !(current->mask & bit)) {
+                current->registers[id] = previous->registers[id];
+            }
+        }
+        current->mask |= previous->mask;
+    }
+
+    xform->table = table;
+    xform->scan_lines = scan_lines;
+
+    return true;
+}
+
+// Floor perspective, rotated by `angle` around the view-point at `elevation` from the floor. The scale of each
+// scan-line is inversely proportional to its distance from the horizon (i.e. the first scan-line).
+bool GL_xform_table_perspective(GL_XForm_t *xform, size_t height, float angle, float elevation)
+{
+    GL_xform_table_clear(xform);
+
+    if (height == 0) {
+        return true;
+    }
+
+    const float c = cosf(angle);
+    const float s = sinf(angle);
+
+    GL_XForm_Scan_Line_t *table = malloc(sizeof(GL_XForm_Scan_Line_t) * height);
+    if (!table) {
+        Log_write(LOG_LEVELS_ERROR, LOG_CONTEXT, "can't allocate %d scan-lines table", height);
+        return false;
+    }
+
+    for (size_t i = 0; i < height; ++i) {
+        const float p = elevation / (float)(i + 1);
+        table[i] = (GL_XForm_Scan_Line_t){
+                .registers = {
+                    [GL_XFORM_REGISTER_A] = c * p,
+                    [GL_XFORM_REGISTER_B] = s * p,
+                    [GL_XFORM_REGISTER_C] = -s * p,
+                    [GL_XFORM_REGISTER_D] = c * p
+                },
+                .mask = (1u << GL_XFORM_REGISTER_A) | (1u << GL_XFORM_REGISTER_B) | (1u << GL_XFORM_REGISTER_C) | (1u << GL_XFORM_REGISTER_D)
+            };
+    }
+
+    xform->table = table;
+    xform->scan_lines = height;
+
+    return true;
+}
+
+void GL_xform_table_clear(GL_XForm_t *xform)
+{
+    free(xform->table);
+    xform->table = NULL;
+    xform->scan_lines = 0;
+}
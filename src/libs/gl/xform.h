@@ -25,6 +25,10 @@
 
 #include "common.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef enum _GL_XForm_Registers_t {
     GL_XForm_Registers_t_First,
     GL_XFORM_REGISTER_H = GL_XForm_Registers_t_First,
@@ -50,6 +54,13 @@ typedef struct _GL_XForm_Table_Entry_t {
     size_t count;
 } GL_XForm_Table_Entry_t;
 
+// Compiled table, one entry for each scan-line, holding the value of each register the table changed so far. The
+// last entry holds for the following scan-lines, too.
+typedef struct _GL_XForm_Scan_Line_t {
+    float registers[GL_XForm_Registers_t_CountOf];
+    uint32_t mask; // Bit `n` is set when the register with id `n` is overridden.
+} GL_XForm_Scan_Line_t;
+
 typedef enum _GL_XForm_Clamps_t {
     GL_XFORM_CLAMP_EDGE,
     GL_XFORM_CLAMP_BORDER,
@@ -59,9 +70,12 @@ typedef enum _GL_XForm_Clamps_t {
 typedef struct _GL_XForm_t {
     float registers[GL_XForm_Registers_t_CountOf];
     GL_XForm_Clamps_t clamp;
-    GL_XForm_Table_Entry_t *table;
+    GL_XForm_Scan_Line_t *table; // `NULL` when the transformation has no table.
+    size_t scan_lines;
 } GL_XForm_t;
 
-// TODO: add helper functions to generate common transformations?
+extern bool GL_xform_table_compile(GL_XForm_t *xform, const GL_XForm_Table_Entry_t *entries, size_t count, size_t height);
+extern bool GL_xform_table_perspective(GL_XForm_t *xform, size_t height, float angle, float elevation);
+extern void GL_xform_table_clear(GL_XForm_t *xform);
 
 #endif  /* __GL_XFORM_H__ */
\ No newline at end of file
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2019-2020 by Marco Lizza (marco.lizza@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+#include "lz4.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define LZ4_MIN_MATCH   4
+
+static inline bool _read_length(const uint8_t **ip, const uint8_t *ip_end, size_t *length)
+{
+    uint8_t byte;
+    do {
+        if (*ip == ip_end) {
+            return false;
+        }
+        byte = *((*ip)++);
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+size_t lz4_decompress(const uint8_t *source, size_t source_size, uint8_t *destination, size_t destination_size)
+{
+    const uint8_t *ip = source;
+    const uint8_t *ip_end = source + source_size;
+    uint8_t *op = destination;
+    const uint8_t *op_end = destination + destination_size;
+
+    while (ip < ip_end) {
+        const uint8_t token = *(ip++);
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !_read_length(&ip, ip_end, &literals)) {
+            return 0;
+        }
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op)) {
+            return 0;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == ip_end) { // The last sequence is made of literals only.
+            break;
+        }
+
+        if (ip_end - ip < 2) {
+            return 0;
+        }
+        const size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - destination)) {
+            return 0;
+        }
+
+        size_t length = token & 0x0F;
+        if (length == 15 && !_read_length(&ip, ip_end, &length)) {
+            return 0;
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(op_end - op)) {
+            return 0;
+        }
+
+        const uint8_t *match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else { // Overlapping match, replicates the last `offset` bytes.
+            for (size_t i = length; i; --i) {
+                *(op++) = *(match++);
+            }
+        }
+    }
+
+    return (size_t)(op - destination);
+}